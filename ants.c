@@ -17,14 +17,49 @@ enum {
   food_center_y = 192,
   food_radius   = 15,
 
-  nest_x        = grid_width / 2,
-  nest_y        = grid_height / 2,
   nest_radius   = 15,
 };
 
-static unsigned heading[grid_size];
-static int      gland[grid_size];
-static unsigned scent[grid_size];
+#define nest_x (grid_width / 2)
+#define nest_y (grid_height / 2)
+
+/* The ants, each with a heading and a gland full of scent. */
+enum { emptyhanded_kind = 1, carrying_kind };
+static Agents ants;
+static unsigned *heading;
+static int      *gland;
+
+/* What's on the ground in each cell. */
+enum { bare_ground, food_ground };
+static Uint8 *ground;
+
+static const Pixel ant_colors[]    = { empty, emptyhanded, carrying };
+static const Pixel ground_colors[] = { empty, food };
+
+static Field     scent;
+
+/* Bring the grid up to date for show(). */
+static void
+render (void)
+{
+  render_agents (&ants, ant_colors, ground, ground_colors);
+}
+
+static void
+size_state (void)
+{
+  size_agents (&ants);
+  ground = reallot_grid (ground, sizeof ground[0]);
+  size_field (&scent);
+  if (render_hook == render)
+    render_hook = NULL;
+}
+
+static INLINE int
+vacant (int cell)
+{
+  return kind_at (&ants, cell) == 0 && ground[cell] == bare_ground;
+}
 
 static INLINE int
 in_nest (unsigned x, unsigned y)
@@ -45,53 +80,56 @@ nest_distance_squared (unsigned patch)
 static void
 make_ant (int i)
 {
-  grid[i] = emptyhanded;
-  heading[i] = fast_rand () % 8;  
+  int a = add_agent (&ants, i, emptyhanded_kind);
+  heading[a] = fast_rand () % 8;  
 }
 
 static void
-genesis (int ants, int foods)
+genesis (int population, int foods)
 {
   int i;
-  memset (scent, 0, sizeof scent);
+  clear_agents (&ants);
+  clear_field (&scent);
+  memset (ground, bare_ground, grid_size * sizeof ground[0]);
   for (i = 0; i < foods; ++i)
     {
-      int p = pick_empty_patch (grid, empty);
+      int p = pick_vacant_cell (&ants, ground);
       int x = p % grid_width;
       int y = p / grid_width;
       if (hypot (x - food_center_x, y - food_center_y) < food_radius)
-	grid[p] = food;
+	ground[p] = food_ground;
       if (hypot (x - nest_x, y - (nest_y - 40)) < food_radius)
-	grid[p] = food;
+	ground[p] = food_ground;
     }
-  for (i = 0; i < ants; ++i)
-    make_ant (pick_empty_patch (grid, empty));
+  for (i = 0; i < population; ++i)
+    make_ant (pick_vacant_cell (&ants, ground));
+  render_hook = render;
 }
 
 static void
 emptyhanded_move (int ant, unsigned x, unsigned y)
 {
+  int cell = at (x, y);
   heading[ant] =
-    ((15 < scent[ant] ? follow_gradient_unsigned (scent, heading[ant], x, y) 
-                      : heading[ant])
+    ((15 < scent.value[cell] 
+      ? follow_gradient_unsigned (scent.value, heading[ant], x, y) 
+      : heading[ant])
      + (fast_rand () % 3) - 1) % 8;
   {
     unsigned neighbor = move2 (x, y, heading[ant]);
-    if (grid[neighbor] == food)
+    if (ground[neighbor] == food_ground)
       {
-	grid[ant] = carrying;
+	ground[neighbor] = bare_ground;
+	set_agent_kind (&ants, ant, carrying_kind);
 	gland[ant] = 16000;
       }
-    else if (grid[neighbor] != empty)
+    else if (!vacant (neighbor))
       {
 	heading[ant] = fast_rand () % 8;
 	return;
       }
 
-    grid[neighbor]    = grid[ant];
-    heading[neighbor] = heading[ant];
-
-    grid[ant]         = empty;
+    move_agent (&ants, ant, neighbor);
   }  
 }
 
@@ -127,12 +165,12 @@ carrying_move (int ant, unsigned x, unsigned y)
   heading[ant] = dir;
   {
     unsigned neighbor = move2 (x, y, dir);
-    if (grid[neighbor] != empty)
+    if (!vacant (neighbor))
       heading[ant] = fast_rand () % 8;
     else if (in_nest (x, y) && fast_rand () % 4 == 0)
       {
-	grid[neighbor] = food;
-	grid[ant]      = emptyhanded;
+	ground[neighbor] = food_ground;
+	set_agent_kind (&ants, ant, emptyhanded_kind);
 	heading[ant]   = (dir + 4) % 8; /* turn around */
       }
     else
@@ -142,50 +180,47 @@ carrying_move (int ant, unsigned x, unsigned y)
 	    int gl = gland[ant];
 	    if (0 < gl)
 	      {
-		scent[ant] += gl;
+		field_add (&scent, x, y, gl);
 		gland[ant] -= 128;
 	      }
 	  }
 
-	grid[neighbor]    = carrying;
-	heading[neighbor] = dir;
-	
-	grid[ant]         = empty;
+	move_agent (&ants, ant, neighbor);
       }
   }  
 }
 
-static INLINE void
-diffuse8_unsigned (unsigned *array, unsigned x, unsigned y, unsigned fraction)
+/* Evaporate 1/512 of the scent, and spread 1/64 of the rest to each
+   neighbor. */
+static void
+spread_scent (void)
 {
-  double droplet = array[at (x, y)] / fraction;
-  int i;
-  for (i = 0; i < 8; ++i)
-    array[move2 (x, y, i)] += droplet;
-  array[at (x, y)] -= 8 * droplet;
+  diffuse_field (&scent, 511, 9, 6);
 }
 
-static INLINE void
-update_patch (int cell, unsigned x, unsigned y)
+static void
+tick (void)
 {
-  if (0 < scent[cell])
-    {
-      scent[cell] = (scent[cell] * 511) / 512;
-      diffuse8_unsigned (scent, x, y, 64);
-    }
+  spread_scent ();
+  for_all_agents (&ants, emptyhanded_kind, emptyhanded_move);
+  for_all_agents (&ants, carrying_kind, carrying_move);
 }
 
 static void
-tick (void)
+parallel_tick (void)
 {
-  FOR_ALL_PATCHES (update_patch);
-  FOR_ALL_TURTLES (grid, emptyhanded, emptyhanded_move);
-  FOR_ALL_TURTLES (grid, carrying, carrying_move);
+  spread_scent ();
+  for_all_agents_in_parallel (&ants, emptyhanded_kind, emptyhanded_move);
+  for_all_agents_in_parallel (&ants, carrying_kind, carrying_move);
 }
 
 void
 install_ants_words (ts_VM *vm)
 {
+  add_agent_field (&ants, &heading, sizeof heading[0]);
+  add_agent_field (&ants, &gland,   sizeof gland[0]);
+  on_new_grid (size_state);
   ts_install (vm, "ants-genesis", ts_run_void_2, (tsint) genesis);
   ts_install (vm, "ants-tick",    ts_run_void_0, (tsint) tick);
+  ts_install (vm, "ants-parallel-tick", ts_run_void_0, (tsint) parallel_tick);
 }
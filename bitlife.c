@@ -0,0 +1,269 @@
+/*
+ Conway's Life on bit-planes: 64 cells to a machine word, stepped with
+ bit-sliced adders instead of a neighbor sum per cell. It computes the
+ same generations as casdl's life-step, including the was-alive-last-
+ frame bit that 4-colors shows, but only unpacks them into grid8 when
+ the screen is about to be shown.
+
+ The adders are written once, over a type that's either a plain 64-bit
+ word or a gcc vector of them; build with -march=native (or -mavx2,
+ -mavx512f) to get the wider vectors.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tusdl.h"
+
+typedef unsigned long long Bits;
+
+#if defined (__AVX512F__)
+enum { lanes = 8 };
+#elif defined (__AVX2__)
+enum { lanes = 4 };
+#else
+enum { lanes = 2 };
+#endif
+
+/* A vector of Bits that may be loaded from any Bits-aligned address. */
+typedef Bits Vec __attribute__ ((vector_size (lanes * sizeof (Bits)),
+				 aligned (sizeof (Bits)), may_alias));
+
+enum { word_bits = 64 };
+
+/* Set by size_planes() to fit the grid. */
+static int row_words;		/* (grid_width + word_bits - 1) / word_bits */
+static int plane_words;		/* row_words * grid_height */
+static int tail_bits;		/* bits used in a row's last word: 1..64 */
+static Bits tail_mask;
+
+/* Cell x of row y is bit x%64 of word y*row_words + x/64. The bits
+   past grid_width at the end of each row are kept zero. */
+static Bits *planes    = NULL;	/* both planes, end to end */
+static Bits *alive     = NULL;	/* this generation */
+static Bits *was_alive = NULL;	/* the one before */
+
+/* Horizontal 3-cell sums of each row (2 bits: sum0 + 2*sum1), with a
+   halo row above and below holding copies of the opposite edge. */
+static Bits *sum0_rows = NULL;
+static Bits *sum1_rows = NULL;
+
+/* True iff the planes have changed since they were last unpacked. */
+static int dirty = 0;
+
+/* out <- the sum of the three bits w+c+e, as bit-planes s0 (ones) and
+   s1 (twos). Works for both Bits and Vec. */
+#define ADD3(s0, s1, w, c, e)                   \
+  do {                                          \
+    t = (w) ^ (c);                              \
+    s1 = ((w) & (c)) | (t & (e));               \
+    s0 = t ^ (e);                               \
+  } while (0)
+
+/* Given the three horizontal sums of the rows above, at and below a
+   cell (each a 2-bit count), and whether the cell itself is alive,
+   compute whether it's alive next. The 9-cell sum includes the cell,
+   so the rule is: sum == 3, or alive and sum == 4. */
+#define RULE(out, a, u0, u1, m0, m1, d0, d1)                    \
+  do {                                                          \
+    ADD3 (s0, c1, u0, m0, d0);   /* ones, carry to twos */      \
+    ADD3 (x0, x1, u1, m1, d1);   /* twos, carry to fours */     \
+    s1 = x0 ^ c1;                                               \
+    y1 = x0 & c1;                                               \
+    out = (s0 & s1 & ~(x1 | y1)) | ((a) & ~(s0 | s1) & (x1 ^ y1)); \
+  } while (0)
+
+/* Turn each row's alive cells in sum0/sum1 (which hold the west and
+   east neighbors on entry) into horizontal 3-sums, in place. */
+static void
+sum_rows (Bits *sum0, Bits *sum1, const Bits *c, int n)
+{
+  int i = 0;
+  {
+    Vec t;
+    for (; i + lanes <= n; i += lanes)
+      {
+	Vec w = *(Vec *)&sum0[i], e = *(Vec *)&sum1[i], cc = *(Vec *)&c[i];
+	Vec s0, s1;
+	ADD3 (s0, s1, w, cc, e);
+	*(Vec *)&sum0[i] = s0;
+	*(Vec *)&sum1[i] = s1;
+      }
+  }
+  {
+    Bits t;
+    for (; i < n; ++i)
+      {
+	Bits s0, s1;
+	ADD3 (s0, s1, sum0[i], c[i], sum1[i]);
+	sum0[i] = s0;
+	sum1[i] = s1;
+      }
+  }
+}
+
+/* out[i] <- the next state of the cells in a[i], where sum0/sum1 point
+   at the row sums for a[0]; the rows above and below are `stride'
+   words away. */
+static void
+apply_rule (Bits *out, const Bits *a,
+	    const Bits *sum0, const Bits *sum1, int n, int stride)
+{
+  int i = 0;
+  {
+    Vec t, s0, s1, c1, x0, x1, y1;
+    for (; i + lanes <= n; i += lanes)
+      RULE (*(Vec *)&out[i], *(Vec *)&a[i],
+	    *(Vec *)&sum0[i - stride], *(Vec *)&sum1[i - stride],
+	    *(Vec *)&sum0[i],          *(Vec *)&sum1[i],
+	    *(Vec *)&sum0[i + stride], *(Vec *)&sum1[i + stride]);
+  }
+  {
+    Bits t, s0, s1, c1, x0, x1, y1;
+    for (; i < n; ++i)
+      RULE (out[i], a[i],
+	    sum0[i - stride], sum1[i - stride],
+	    sum0[i],          sum1[i],
+	    sum0[i + stride], sum1[i + stride]);
+  }
+}
+
+/* Put row c's west and east neighbors into w and e, wrapping around
+   the torus. (The cell west of x is x-1, so w's bits are shifted up.) */
+static INLINE void
+shift_row (Bits *w, Bits *e, const Bits *c)
+{
+  const int last = row_words - 1;
+  Bits first_bit = c[0] & 1;
+  Bits last_bit  = (c[last] >> (tail_bits - 1)) & 1;
+  int i;
+
+  w[0] = (c[0] << 1) | last_bit;
+  for (i = 1; i <= last; ++i)
+    w[i] = (c[i] << 1) | (c[i-1] >> (word_bits - 1));
+
+  for (i = 0; i < last; ++i)
+    e[i] = (c[i] >> 1) | (c[i+1] << (word_bits - 1));
+  e[last] = (c[last] >> 1) | (first_bit << (tail_bits - 1));
+}
+
+/* Advance one generation. */
+static void
+bit_life_step (void)
+{
+  Bits *sum0 = sum0_rows + row_words; /* skip the halo row */
+  Bits *sum1 = sum1_rows + row_words;
+  int y;
+
+  for (y = 0; y < grid_height; ++y)
+    {
+      int k = y * row_words;
+      shift_row (sum0 + k, sum1 + k, alive + k);
+    }
+  sum_rows (sum0, sum1, alive, plane_words);
+
+  memcpy (sum0 - row_words, sum0 + plane_words - row_words,
+	  row_words * sizeof sum0[0]);
+  memcpy (sum1 - row_words, sum1 + plane_words - row_words,
+	  row_words * sizeof sum1[0]);
+  memcpy (sum0 + plane_words, sum0, row_words * sizeof sum0[0]);
+  memcpy (sum1 + plane_words, sum1, row_words * sizeof sum1[0]);
+
+  /* The old was_alive plane is dead weight now; reuse it for the
+     next generation. */
+  apply_rule (was_alive, alive, sum0, sum1, plane_words, row_words);
+  for (y = 0; y < grid_height; ++y)
+    was_alive[y * row_words + row_words - 1] &= tail_mask;
+
+  {
+    Bits *t = alive;
+    alive = was_alive;
+    was_alive = t;
+  }
+  dirty = 1;
+}
+
+/* Unpack the planes into grid8 the way life-step leaves it: bit 0 is
+   alive now, bit 1 was alive the generation before. */
+static void
+unpack (void)
+{
+  int y;
+  if (!dirty || grid8 == NULL)
+    return;
+  for (y = 0; y < grid_height; ++y)
+    {
+      Uint8 *out = grid8 + y * grid_width;
+      const Bits *a = alive + y * row_words;
+      const Bits *w = was_alive + y * row_words;
+      int x;
+      for (x = 0; x < grid_width; ++x)
+	{
+	  int k = x % word_bits;
+	  out[x] = (((w[x / word_bits] >> k) & 1) << 1)
+	         | ((a[x / word_bits] >> k) & 1);
+	}
+    }
+  dirty = 0;
+}
+
+static Bits *
+allot_bits (Bits *old, int n)
+{
+  Bits *p;
+  free (old);
+  p = calloc (n, sizeof p[0]);
+  if (p == NULL)
+    die ("Out of memory for bit planes");
+  return p;
+}
+
+/* Fit the planes to a newly made grid. */
+static void
+size_planes (void)
+{
+  row_words   = (grid_width + word_bits - 1) / word_bits;
+  plane_words = row_words * grid_height;
+  tail_bits   = grid_width - (row_words - 1) * word_bits;
+  tail_mask   = ~(Bits)0 >> (word_bits - tail_bits);
+
+  planes    = allot_bits (planes, 2 * plane_words);
+  alive     = planes;
+  was_alive = planes + plane_words;
+  sum0_rows = allot_bits (sum0_rows, plane_words + 2*row_words);
+  sum1_rows = allot_bits (sum1_rows, plane_words + 2*row_words);
+  dirty = 0;
+  if (render_hook == unpack)
+    render_hook = NULL;
+}
+
+/* Pack grid8 into the planes and start showing them. */
+static void
+bit_life_load (void)
+{
+  int y;
+  memset (planes, 0, 2 * plane_words * sizeof planes[0]);
+  for (y = 0; y < grid_height; ++y)
+    {
+      const Uint8 *in = grid8 + y * grid_width;
+      Bits *a = alive + y * row_words;
+      Bits *w = was_alive + y * row_words;
+      int x;
+      for (x = 0; x < grid_width; ++x)
+	{
+	  Bits bit = (Bits)1 << (x % word_bits);
+	  if (in[x] & 1) a[x / word_bits] |= bit;
+	  if (in[x] & 2) w[x / word_bits] |= bit;
+	}
+    }
+  dirty = 0;
+  render_hook = unpack;
+}
+
+void
+install_bitlife_words (ts_VM *vm)
+{
+  on_new_grid (size_planes);
+  ts_install (vm, "bit-life-load",   ts_run_void_0, (tsint) bit_life_load);
+  ts_install (vm, "bit-life-step",   ts_run_void_0, (tsint) bit_life_step);
+}
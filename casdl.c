@@ -3,11 +3,10 @@
 #include <unistd.h>
 
 #include "tusdl.h"
+#include "workers.h"
 
-enum { 
-  WIDTH  = grid_width,
-  HEIGHT = grid_height
-};
+#define WIDTH  grid_width
+#define HEIGHT grid_height
 
 
 static inline void
@@ -82,7 +81,8 @@ life_update_cell (int a1, int a2, int a3,
 
 static inline void
 life_update_row (Uint8 *out, 
-		 const Uint8 *in1, const Uint8 *in2, const Uint8 *in3)
+		 const Uint8 *in1, const Uint8 *in2, const Uint8 *in3,
+		 int width)
 {
   int x;
   int i11, i10, i21, i20, i31, i30;
@@ -90,11 +90,11 @@ life_update_row (Uint8 *out,
   i11 = in1[0], i10 = in1[1];
   i21 = in2[0], i20 = in2[1];
   i31 = in3[0], i30 = in3[1];
-  out[0] = life_update_cell (in1[WIDTH-1], i11, i10,
-			     in2[WIDTH-1], i21, i20,
-			     in3[WIDTH-1], i31, i30);
+  out[0] = life_update_cell (in1[width-1], i11, i10,
+			     in2[width-1], i21, i20,
+			     in3[width-1], i31, i30);
 
-  for (x = 1; x < WIDTH-1; ++x)
+  for (x = 1; x < width-1; ++x)
     {
       int j1 = in1[x+1];
       int j2 = in2[x+1];
@@ -112,24 +112,83 @@ life_update_row (Uint8 *out,
 			     i31, i30, in3[0]);
 }
 
+/* The work of one life_step: the grid is cut into horizontal bands,
+   one per worker, each stepped from saved copies of the rows just
+   outside it (its halo) as they were before the step began. */
+typedef struct Life_band Life_band;
+struct Life_band {
+  int y0, y1;			/* Rows y0..y1-1 */
+  Uint8 *above;			/* Row y0-1, wrapping around */
+  Uint8 *below;			/* Row y1, wrapping around */
+  Uint8 *row[2];		/* Rolling copies of rows within */
+};
+
+static Life_band life_bands[max_workers];
+static Uint8 *life_band_rows = NULL;
+
+/* Give each band its four rows of the new grid's width. */
 static void
-life_step (void)
+size_life_bands (void)
+{
+  int b;
+  free (life_band_rows);
+  life_band_rows = malloc (max_workers * 4 * WIDTH);
+  if (life_band_rows == NULL)
+    die ("Out of memory for life bands");
+  for (b = 0; b < max_workers; ++b)
+    {
+      Uint8 *rows = life_band_rows + b * 4 * WIDTH;
+      life_bands[b].above  = rows;
+      life_bands[b].below  = rows + WIDTH;
+      life_bands[b].row[0] = rows + 2 * WIDTH;
+      life_bands[b].row[1] = rows + 3 * WIDTH;
+    }
+}
+
+/* Pre: width == WIDTH. It's passed in so the usual width can get a
+   copy of the loop with a constant trip count. */
+static inline void
+life_step_rows (Life_band *band, int width)
 {
-  static Uint8 row[2][WIDTH];
-  static Uint8 top_row[WIDTH];
   int y;
 
-  copy_row (top_row, 0);	/* save for the end */
+  memcpy (band->row[(band->y0 - 1) & 1], band->above, width);
+  for (y = band->y0; y < band->y1; ++y)
+    {
+      copy_row (band->row[y & 1], y);
+      life_update_row (grid8 + y * width,
+		       band->row[(y-1) & 1], 
+		       band->row[y & 1], 
+		       y == band->y1-1 ? band->below : grid8 + (y+1) * width,
+		       width);
+    }
+}
 
-  copy_row (row[1], HEIGHT-1);	/* prime the pump */
-  for (y = 0; y < HEIGHT; ++y)
+static void
+life_step_band (void *data, int index, int worker)
+{
+  Life_band *band = (Life_band *) data + index;
+  if (WIDTH == 1024)
+    life_step_rows (band, 1024);
+  else
+    life_step_rows (band, WIDTH);
+}
+
+static void
+life_step (void)
+{
+  int n = worker_count () < HEIGHT ? worker_count () : HEIGHT;
+  int b;
+
+  for (b = 0; b < n; ++b)
     {
-      copy_row (row[y & 1], y);
-      life_update_row (grid8 + y * WIDTH,
-		       row[(y-1) & 1], 
-		       row[y & 1], 
-		       y == HEIGHT-1 ? top_row : grid8 + (y+1) * WIDTH);
+      Life_band *band = &life_bands[b];
+      band->y0 = b * HEIGHT / n;
+      band->y1 = (b+1) * HEIGHT / n;
+      copy_row (band->above, band->y0 == 0 ? HEIGHT-1 : band->y0 - 1);
+      copy_row (band->below, band->y1 == HEIGHT ? 0 : band->y1);
     }
+  run_jobs (life_step_band, life_bands, n);
 }
 
 
@@ -158,22 +217,36 @@ margolus_update_row (int parity, Uint8 *top, Uint8 *bot)
 			    bot + x, bot + x + 1);
 }
 
-/* Pre: WIDTH and HEIGHT are multiples of 2 */
+/* Margolus neighborhoods never overlap, so the pairs of rows can be
+   split into bands and updated independently. */
+static int margolus_bands;
+
 static void
-margolus_step (void)
+margolus_step_band (void *data, int index, int worker)
 {
-  int y, p = frame & 1;
+  int p = frame & 1;
+  int pairs = HEIGHT / 2;
+  int k;
 
-  if (p)
-    margolus_update_row (p, grid8 + (HEIGHT-1) * WIDTH, grid8);
-
-  for (y = p; y < HEIGHT-1; y += 2)
+  for (k = index * pairs / margolus_bands;
+       k < (index+1) * pairs / margolus_bands;
+       ++k)
     {
-      int offset = y * WIDTH;
-      margolus_update_row (p, grid8 + offset, grid8 + offset + WIDTH);
+      int y = p + 2*k;
+      margolus_update_row (p,
+			   grid8 + y * WIDTH,
+			   grid8 + (y+1 == HEIGHT ? 0 : y+1) * WIDTH);
     }
 }
 
+/* Pre: WIDTH and HEIGHT are multiples of 2 */
+static void
+margolus_step (void)
+{
+  margolus_bands = worker_count () < HEIGHT/2 ? worker_count () : HEIGHT/2;
+  run_jobs (margolus_step_band, NULL, margolus_bands);
+}
+
 
 static SDL_Color colors[256];
 
@@ -188,7 +261,7 @@ wipe_colors (void)
       colors[i].b = 0;
     }
 
-  SDL_SetColors (screen, colors, 0, 256);	/* XXX */
+  set_colors (colors, 0, 256);
 }
 
 static void
@@ -208,7 +281,7 @@ decay_colors (void)
   colors[i].g = 255;
   colors[i].b = 255;
 
-  SDL_SetColors (screen, colors, 0, 256);	/* XXX */
+  set_colors (colors, 0, 256);
 }
 
 static void
@@ -230,12 +303,14 @@ four_colors (void)
   colors[3].g = 0;
   colors[3].b = 0;
 
-  SDL_SetColors (screen, colors, 0, 4);
+  set_colors (colors, 0, 4);
 }
 
 void
 install_casdl_words (ts_VM *vm)
 {
+  on_new_grid (size_life_bands);
+
   ts_install (vm, "4-colors",        ts_run_void_0, (tsint) four_colors);
   ts_install (vm, "wipe-colors",     ts_run_void_0, (tsint) wipe_colors);
   ts_install (vm, "decay-colors",    ts_run_void_0, (tsint) decay_colors);
@@ -42,6 +42,12 @@
 
 :marg                show  quit? (unless)  margolus-step  tally sheesh marg ;
 :life                show  quit? (unless)  life-step      tally life ;
+:bit-life            show  quit? (unless)  bit-life-step  tally bit-life ;
+
+\ HashLife jumps 2^hash-step generations per frame.
+:hash-step (0 variable)
+:hash-life  0 0 hashlife-show  show  quit? (unless)
+            hash-step @ hashlife-jump  tally hash-life ;
 :munch  decay-colors show  quit? (unless)  munch-step     tally munch ;
 
 :sierp    show  quit? (unless)  1 under+  4dup sierp-step  tally sierp ;
@@ -51,6 +57,8 @@
 
 \ Here are some top-level animations to try.
 :r-pentomino   4-colors     clear  center r!  life ;
+:fast-r-pentomino  4-colors  clear  center r!  bit-life-load  bit-life ;
+:long-r-pentomino  4-colors  clear  center r!  hashlife-load  6 hash-step !  hash-life ;
 :bubbles       4-colors     clear  center block!  0 frames !u  marg ;
 :m             wipe-colors  clear  munch ;
 :s             center 0 20 sierp  wxyz- ;
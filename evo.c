@@ -16,6 +16,7 @@
 #include <time.h>
 
 #include "sim.h"
+#include "workers.h"
 
 
 /* Configurable constants */
@@ -46,23 +47,28 @@ enum {
   thumb_cols      = 4,		/* in tiles */
   thumb_rows      = 4,
 #endif
-
-  node_table_size = 101, 	/* # of buckets in a hashtable */
 };
 
 /* Derived constants */
 enum {
-  /* And the full image grid uses a whole number of thumbnails. */
-  cols            = grid_width / (tile_width*thumb_cols), /* in thumbs */
-  rows            = grid_height / (tile_height*thumb_rows),
-
   tile_size       = tile_width * tile_height,
 
-  thumb_width     = grid_width / cols,
-  thumb_height    = grid_height / rows,
-  thumb_size      = thumb_width * thumb_height,
+  /* Compiling makes at most an RGB triple of nodes per instruction,
+     plus the initial zero node. */
+  max_nodes       = 3 * program_length + 1,
+  node_table_size = 256,	/* a power of 2, at least 2*max_nodes */
+
+  /* Fused evaluation runs a whole program over this many rows of a
+     tile at a time. */
+  chunk_rows      = 4,
+  chunk_size      = chunk_rows * tile_width,
 };
 
+/* And the full image grid uses a whole number of thumbnails, however
+   many fit the grid we're given; lay_out() sets these when it's made. */
+static int cols, rows;		/* in thumbs */
+static int thumb_width, thumb_height;
+
 /* Pixel types -- not actually configurable without changing the code
    manipulating pixel values. */
 enum {
@@ -191,9 +197,32 @@ color_value (Intensity intensity)
 #define FOR_EACH(x, y, j)              \
   int x, y, j;                         \
   for (y = 0; y < tile_height; ++y)    \
-    for (x = 0, j = tile_width * y; x < tile_width; ++x, j = x + tile_width * y)
+    for (x = 0, j = tile_width * y; x < tile_width; ++x, ++j)
+
+/* Loop through each array offset j in a run of 'count' pixels of a
+   tile, in the same order, for ops that don't care about (x,y) -- a
+   plain loop the compiler can vectorize. */
+#define FOR_EACH_PIXEL(j, count)       \
+  int j;                               \
+  for (j = 0; j < (count); ++j)
+
+/* Write a's color values as RGB bytes into 'dest', whose rows are
+   'stride' bytes apart. */
+static void
+rgbify (Intensity **a, Uint8 *dest, int stride)
+{
+  Intensity *ar = a[0], *ag = a[1], *ab = a[2];
+  FOR_EACH (x, y, j)
+    {
+      Uint8 *p = dest + y * stride + 3 * x;
+      p[0] = color_value (ar[j]);
+      p[1] = color_value (ag[j]);
+      p[2] = color_value (ab[j]);
+    }
+}
 
-/* Write a's color values into the grid tile at (x0,y0) (upper left corner). */ 
+/* Write a's color values into the grid tile at (x0,y0) (upper left corner). 
+   (Not with put(), since workers call this.) */
 static void
 gridify (Intensity **a, int x0, int y0)
 {
@@ -203,8 +232,27 @@ gridify (Intensity **a, int x0, int y0)
       Pixel r = color_value (ab[j]) +
 	(color_value (ar[j]) << 16) + 
 	(color_value (ag[j]) << 8);
-      put (x0 + x, y0 + y, r);
+      grid[at (x0 + x, y0 + y)] = r;
     }
+  mark_dirty (x0, y0, tile_width, tile_height);
+}
+
+/* Like gridify, but blowing each pixel up into a bw x bh block. */
+static void
+gridify_blocks (Intensity **a, int x0, int y0, int bw, int bh)
+{
+  Intensity *ar = a[0], *ag = a[1], *ab = a[2];
+  FOR_EACH (x, y, j)
+    {
+      Pixel r = color_value (ab[j]) +
+	(color_value (ar[j]) << 16) + 
+	(color_value (ag[j]) << 8);
+      int u, v;
+      for (v = 0; v < bh; ++v)
+	for (u = 0; u < bw; ++u)
+	  grid[at (x0 + bw * x + u, y0 + bh * y + v)] = r;
+    }
+  mark_dirty (x0, y0, bw * tile_width, bh * tile_height);
 }
 
 
@@ -212,12 +260,200 @@ gridify (Intensity **a, int x0, int y0)
 
 /* Fill dest with a constant color. */
 static void
-op_constant (Intensity constant_value, Intensity *dest)
+op_constant (Intensity constant_value, Intensity *dest, int count)
 {
-  FOR_EACH (x, y, j)
+  FOR_EACH_PIXEL (j, count)
     dest[j] = constant_value;
 }
 
+/* Nonzero to evaluate the transcendental ops with the approximations
+   below instead of libm. They work in single precision without
+   branches or calls, so whole tiles of them vectorize; but the
+   pictures come out slightly different, so it's off by default. */
+static int fast_math = 0;
+
+
+/* Fast approximate math (for fast_math mode)
+   Every operation here is done unconditionally, with ?: only choosing
+   between finished values, so the compiler can turn a loop of them
+   into straight-line vector code. */
+
+static INLINE unsigned
+float_bits (float f)
+{
+  unsigned u;
+  memcpy (&u, &f, sizeof u);
+  return u;
+}
+
+static INLINE float
+bits_float (unsigned u)
+{
+  float f;
+  memcpy (&f, &u, sizeof f);
+  return f;
+}
+
+/* Round toward zero. Adding and taking away 2^23 rounds |x| to a
+   whole number; beyond 2^23 it's whole already. */
+static INLINE float
+fast_trunc (float x)
+{
+  float a = fabsf (x);
+  float r = (a + 8388608.0f) - 8388608.0f;
+  float r1 = r - 1.0f;
+  r = a < r ? r1 : r;
+  r = 8388608.0f <= a ? a : r;
+  return copysignf (r, x);
+}
+
+static INLINE float
+fast_floor (float x)
+{
+  float t = fast_trunc (x);
+  float t1 = t - 1.0f;
+  return x < t ? t1 : t;
+}
+
+/* 2^x, good to about 2e-7 relative. (The polynomial is Cephes's.) */
+static INLINE float
+fast_exp2 (float x)
+{
+  float c = x < -125.0f ? -125.0f : 127.99f < x ? 127.99f : x;
+  float k = fast_trunc (c + copysignf (0.5f, c));
+  float f = c - k;		/* in [-1/2,1/2] */
+  float p = 1.0f + f * (6.931472028550421e-1f + f * (2.402264791363012e-1f 
+	    + f * (5.550332471162809e-2f + f * (9.618437357674640e-3f 
+	    + f * (1.339887440266574e-3f + f * 1.535336188319500e-4f)))));
+  float r = bits_float (float_bits (p) + ((unsigned) (int) k << 23));
+  return x != x ? x : 128.0f <= x ? HUGE_VALF : r;
+}
+
+/* log2 |x|, good to about 2e-7. */
+static INLINE float
+fast_log2 (float x)
+{
+  unsigned bits = float_bits (x) & 0x7fffffff;
+  float e = (float) ((int) (bits >> 23) - 127);
+  float m = bits_float ((bits & 0x007fffff) | 0x3f800000);	/* in [1,2) */
+  int big = 1.41421356f < m;
+  float f, s, s2, r;
+  m = big ? 0.5f * m : m;
+  e = big ? e + 1.0f : e;
+  f = m - 1.0f;
+  s = f / (2.0f + f);		/* log(m) = 2 atanh(s) */
+  s2 = s * s;
+  r = 2.0f * s * (1.0f + s2 * (1/3.0f + s2 * (1/5.0f + s2 * (1/7.0f))));
+  r = e + r * 1.44269504f;
+  return bits == 0 ? -HUGE_VALF : 0x7f800000 <= bits ? fabsf (x) : r;
+}
+
+static INLINE float
+fast_exp (float x)
+{
+  return fast_exp2 (x * 1.44269504f);
+}
+
+static INLINE float
+fast_log (float x)
+{
+  return fast_log2 (x) * 0.69314718f;
+}
+
+static INLINE float
+fast_sin (float x)
+{
+  float t = x * 0.15915494f;	/* in turns */
+  float k = fast_trunc (t + copysignf (0.5f, t));
+  float r = (x - k * 6.28125f) - k * 1.9353072e-3f;	/* in [-pi,pi] */
+  float hi = 3.14159265f - r, lo = -3.14159265f - r;
+  float r2;
+  r = 1.57079633f < r ? hi : r < -1.57079633f ? lo : r;
+  r2 = r * r;
+  return r * (1.0f + r2 * (-1/6.0f + r2 * (1/120.0f + r2 * (-1/5040.0f 
+	 + r2 * (1/362880.0f + r2 * (-1/39916800.0f))))));
+}
+
+static INLINE float
+fast_cos (float x)
+{
+  return fast_sin (x + 1.57079633f);
+}
+
+/* Abramowitz & Stegun 4.4.49, after folding |x| > 1 into [0,1]. */
+static INLINE float
+fast_atan (float x)
+{
+  float a = fabsf (x);
+  float inv = 1.0f / a;
+  float z = 1.0f < a ? inv : a;
+  float z2 = z * z;
+  float p = z * (1.0f + z2 * (-0.3333314528f + z2 * (0.1999355085f 
+	    + z2 * (-0.1420889944f + z2 * (0.1065626393f 
+	    + z2 * (-0.0752896400f + z2 * (0.0429096138f 
+	    + z2 * (-0.0161657367f + z2 * 0.0028662257f))))))));
+  float q = 1.57079633f - p;
+  return copysignf (1.0f < a ? q : p, x);
+}
+
+/* Like pow(), including its treatment of negative bases. */
+static INLINE float
+fast_pow (float a, float b)
+{
+  float r = fast_exp2 (b * fast_log2 (a));
+  float half = 0.5f * b;
+  int whole = fast_trunc (b) == b;
+  int odd = whole && fast_trunc (half) != half;
+  float signed_r = odd ? -r : r;
+  r = a < 0 ? (whole ? signed_r : NAN) : r;
+  return b == 0 ? 1.0f : r;
+}
+
+/* The quotient can round across a whole number, leaving r off by one
+   |b|; fix that up so r keeps fmod()'s sign and range. */
+static INLINE float
+fast_fmod (float a, float b)
+{
+  float r = a - b * fast_trunc (a / b);
+  float m = copysignf (b, a);	/* |b| with a's sign */
+  float up = r + m, down = r - m;
+  r = (a < 0 ? 0 < r : r < 0) ? up : r;
+  return fabsf (m) <= fabsf (r) ? down : r;
+}
+
+/* Like op_hwb_color, below, in single precision and without branches. */
+static void
+fast_hwb_color (Intensity *restrict dr, Intensity *restrict dg, 
+		Intensity *restrict db,
+		Intensity *ar, Intensity *ag, Intensity *ab, int count)
+{
+  FOR_EACH_PIXEL (j, count)
+    {
+      float h = ar[j] - 6.0f * fast_floor (ar[j] * (1/6.0f));
+      float w = ag[j] - fast_trunc (ag[j]);
+      float v = 1.0f - (ab[j] - fast_trunc (ab[j]));
+      float I = fast_trunc (h);
+      float f = h - I, f1 = 1.0f - f;
+      float n, R = v, G, B = w;
+      /* NaN fails every test, leaving case 0. One choice per
+	 statement keeps the compiler from making branches of them. */
+      f = I == 1 ? f1 : f;
+      f = I == 3 ? f1 : f;
+      f = I == 5 ? f1 : f;
+      n = w + f * (v - w);
+      G = n;
+      R = I == 1 ? n : R;  G = I == 1 ? v : G;
+      R = I == 2 ? w : R;  G = I == 2 ? v : G;  B = I == 2 ? n : B;
+      R = I == 3 ? w : R;                       B = I == 3 ? v : B;
+      R = I == 4 ? n : R;  G = I == 4 ? w : G;  B = I == 4 ? v : B;
+			   G = I == 5 ? w : G;  B = I == 5 ? n : B;
+      dr[j] = R;
+      dg[j] = G;
+      db[j] = B;
+    }
+}
+
+
 /* Fill (dr,dg,db) with RGB color values taken by interpreting the
    corresponding (ar,ag,ab) pixel values as HWB colors.
 
@@ -248,9 +484,9 @@ op_constant (Intensity constant_value, Intensity *dest)
  */
 static void
 op_hwb_color (Intensity *dr, Intensity *dg, Intensity *db,
-	      Intensity *ar, Intensity *ag, Intensity *ab)
+	      Intensity *ar, Intensity *ag, Intensity *ab, int count)
 {
-  FOR_EACH (x, y, j)
+  FOR_EACH_PIXEL (j, count)
     {
       double junk;
       Intensity h = fmod (ar[j], 6.0);
@@ -286,74 +522,139 @@ op_hwb_color (Intensity *dr, Intensity *dg, Intensity *db,
     }
 }
 
+/* Which picture a tile belongs to: a thumbnail, the full-grid
+   picture, or one render_image is making at some other size -- or a
+   preview, a whole thumbnail at coarse resolution in a single tile. */
+typedef enum { small, big, image, preview } Coord_system;
+
+/* The coordinate system of the tile being evaluated. (Per thread, like
+   all the evaluation state, since tiles render in parallel.) */
+static __thread Coord_system frame_cs;
+
 /* (x,y) image coordinates of this tile's top-left corner. */
-static double left;
-static double top;
+static __thread double left;
+static __thread double top;
 
 /* width and height in image space of one pixel of this tile. */
-static double x_scale;
-static double y_scale;
+static __thread double x_scale;
+static __thread double y_scale;
+
+/* The ops below work on a run of 'count' pixels of a tile, starting at
+   array offset first_pixel. */
+static __thread int first_pixel;
 
 /* Fill dest with random 1-bit values, on with probability
-   proportional to 'a'. */
+   proportional to 'a', using the random words in 'noise'. */
 static void
-op_sprinkle (Intensity *dest, Intensity *a)
+op_sprinkle (Intensity *dest, Intensity *a, const unsigned *noise, int count)
 {
-  FOR_EACH (x, y, j)
-    dest[j] = (fast_rand () / (double)UINT_MAX < a[j] ? 1.0 : 0.0);
+  FOR_EACH_PIXEL (j, count)
+    dest[j] = (noise[j] / (double)UINT_MAX < a[j] ? 1.0 : 0.0);
+}
+
+/* Fill dest with a random choice of a or b at each pixel, using the
+   random words in 'noise'. */
+static void
+op_mix (Intensity *dest, Intensity *a, Intensity *b, const unsigned *noise,
+	int count)
+{
+  FOR_EACH_PIXEL (j, count)
+    dest[j] = (noise[j] & 1) ? a[j] : b[j];
 }
 
 /* Nullary operator: dest(x,y) = x. */
 static void
-op_x (Intensity *dest, Intensity *a, Intensity *b)
+op_x (Intensity *dest, Intensity *a, Intensity *b, int count)
 {
-  FOR_EACH (x, y, j)
-    dest[j] = left + x_scale * x;
+  FOR_EACH_PIXEL (j, count)
+    dest[j] = left + x_scale * ((first_pixel + j) % tile_width);
 }
 
 /* Nullary operator: dest(x,y) = y. */
 static void
-op_y (Intensity *dest, Intensity *a, Intensity *b)
+op_y (Intensity *dest, Intensity *a, Intensity *b, int count)
 {
-  FOR_EACH (x, y, j)
-    dest[j] = top + y_scale * y;
+  FOR_EACH_PIXEL (j, count)
+    dest[j] = top + y_scale * ((first_pixel + j) / tile_width);
 }
 
 /* Unary operator: dest(x,y) = expr 
    where expr uses arg1 = a(x,y) */
-#define unop(name, exp)                                \
-  static void                                          \
-  name (Intensity *dest, Intensity *a, Intensity *b)   \
-  {                                                    \
-    FOR_EACH (x, y, j)                                 \
-      {                                                \
-	Intensity arg1 = a[j]; dest[j] = exp;          \
-      }                                                \
+#define unop(name, exp)                                                  \
+  static void                                                            \
+  name (Intensity *restrict dest, Intensity *a, Intensity *b, int count) \
+  {                                                                      \
+    FOR_EACH_PIXEL (j, count)                                            \
+      {                                                                  \
+	Intensity arg1 = a[j]; dest[j] = exp;                            \
+      }                                                                  \
   }
 
-unop (op_abs,   fabs (arg1))
-unop (op_atan,  atan (arg1))
-unop (op_cos,   cos (arg1))
-unop (op_exp,   exp (arg1))
-unop (op_floor, floor (arg1))
-unop (op_log,   log (fabs (arg1)))
-unop (op_neg,   -arg1)
-unop (op_sign,  arg1 < 0 ? -1.0 : arg1 == 0 ? 0.0 : 1.0)
-unop (op_sin,   sin (arg1))
-unop (op_sqrt,  sqrt (fabs (arg1)))
-unop (op_tan,   tan (arg1))
+/* Unary operator: dest(x,y) = exp, or fast_exp in fast_math mode. */
+#define mathop1(name, exp, fast_exp)                                     \
+  static void                                                            \
+  name (Intensity *restrict dest, Intensity *a, Intensity *b, int count) \
+  {                                                                      \
+    if (fast_math)                                                       \
+      {                                                                  \
+	FOR_EACH_PIXEL (j, count)                                        \
+	  {                                                              \
+	    Intensity arg1 = a[j]; dest[j] = fast_exp;                   \
+	  }                                                              \
+      }                                                                  \
+    else                                                                 \
+      {                                                                  \
+	FOR_EACH_PIXEL (j, count)                                        \
+	  {                                                              \
+	    Intensity arg1 = a[j]; dest[j] = exp;                        \
+	  }                                                              \
+      }                                                                  \
+  }
+
+unop    (op_abs,   fabs (arg1))
+mathop1 (op_atan,  atan (arg1),        fast_atan (arg1))
+mathop1 (op_cos,   cos (arg1),         fast_cos (arg1))
+mathop1 (op_exp,   exp (arg1),         fast_exp (arg1))
+mathop1 (op_floor, floor (arg1),       fast_floor (arg1))
+mathop1 (op_log,   log (fabs (arg1)),  fast_log (arg1))
+unop    (op_neg,   -arg1)
+unop    (op_sign,  arg1 < 0 ? -1.0 : arg1 == 0 ? 0.0 : 1.0)
+mathop1 (op_sin,   sin (arg1),         fast_sin (arg1))
+mathop1 (op_sqrt,  sqrt (fabs (arg1)), sqrtf (fabsf (arg1)))
+mathop1 (op_tan,   tan (arg1),         fast_sin (arg1) / fast_cos (arg1))
 
 /* Binary operator: dest(x,y) = expr 
    where expr uses arg1 = a(x,y) 
                and arg2 = b(x,y) */
-#define binop(name, exp)                                       \
-  static void                                                  \
-  name (Intensity *dest, Intensity *a, Intensity *b)           \
-  {                                                            \
-    FOR_EACH (x, y, j)                                         \
-      {                                                        \
-	Intensity arg1 = a[j], arg2 = b[j]; dest[j] = exp;     \
-      }                                                        \
+#define binop(name, exp)                                                 \
+  static void                                                            \
+  name (Intensity *restrict dest, Intensity *a, Intensity *b, int count) \
+  {                                                                      \
+    FOR_EACH_PIXEL (j, count)                                            \
+      {                                                                  \
+	Intensity arg1 = a[j], arg2 = b[j]; dest[j] = exp;               \
+      }                                                                  \
+  }
+
+/* Binary operator: dest(x,y) = exp, or fast_exp in fast_math mode. */
+#define mathop2(name, exp, fast_exp)                                     \
+  static void                                                            \
+  name (Intensity *restrict dest, Intensity *a, Intensity *b, int count) \
+  {                                                                      \
+    if (fast_math)                                                       \
+      {                                                                  \
+	FOR_EACH_PIXEL (j, count)                                        \
+	  {                                                              \
+	    Intensity arg1 = a[j], arg2 = b[j]; dest[j] = fast_exp;      \
+	  }                                                              \
+      }                                                                  \
+    else                                                                 \
+      {                                                                  \
+	FOR_EACH_PIXEL (j, count)                                        \
+	  {                                                              \
+	    Intensity arg1 = a[j], arg2 = b[j]; dest[j] = exp;           \
+	  }                                                              \
+      }                                                                  \
   }
 
 /* Convert a floating-point intensity to bits available for bitwise ops. 
@@ -377,12 +678,11 @@ binop (op_sub, arg1 - arg2)
 binop (op_mul, arg1 * arg2)
 binop (op_div, arg1 / arg2)
 binop (op_average, 0.5 * (arg1 + arg2))
-binop (op_hypot, hypot (arg1, arg2))
+mathop2 (op_hypot, hypot (arg1, arg2), sqrtf (arg1 * arg1 + arg2 * arg2))
 binop (op_max, arg1 > arg2 ? arg1 : arg2)
 binop (op_min, arg1 < arg2 ? arg1 : arg2)
-binop (op_mix, (fast_rand () & 1) ? arg1 : arg2)
-binop (op_mod, fmod (arg1, arg2))
-binop (op_pow, pow (arg1, arg2))
+mathop2 (op_mod, fmod (arg1, arg2),  fast_fmod (arg1, arg2))
+mathop2 (op_pow, pow (arg1, arg2),   fast_pow (arg1, arg2))
 binop (op_and, 
        bits_to_intensity (intensity_to_bits (arg1) & intensity_to_bits (arg2)))
 binop (op_or, 
@@ -394,17 +694,16 @@ binop (op_xor,
 /* Result graphs.
    This 'compiled' representation of an evo program is a DAG of op
    nodes. Results are cached on each node, so you evaluate by walking
-   the DAG and checking for cached results. I'm not sure why I didn't
-   make the caching more persistent, to speed up repeated evaluations
-   or evaluations of related programs -- IIRC it took too much memory
-   compared to the thumbnail cache. */
+   the DAG and checking for cached results. Those results last only
+   for one tile of one program; the tile cache below keeps a bounded
+   number of them around for related programs to reuse. */
 
 typedef enum { 
   end, opc0, opc1, opc2, mix, constant, color, hwb, rotcolor, 
   part1, part2, sprinkle 
 } OpType;
 
-typedef void Opcode (Intensity *, Intensity *, Intensity *);
+typedef void Opcode (Intensity *, Intensity *, Intensity *, int);
 
 typedef struct Node Node;
 struct Node {
@@ -418,28 +717,90 @@ struct Node {
                                mix and sprinkle ops) */
   char *name;
   unsigned hashcode;
-  Node *next;		    /* The next node in the hashtable bucket. */
+  unsigned checkcode;	    /* A second, independent structural hash */
+  int cost;		    /* Rough time to compute, in cheap ops */
+  int reg;		    /* Its register in fused evaluation, or -1 */
   Intensity *result;	    /* The computed intensity field, or NULL
                                if not yet computed. */
 };
 
-/* A hashtable with buckets of nodes.  All nodes live here. */
-static Node *node_table[node_table_size];
+/* One instruction of the fused form of a graph (see run_fused). */
+typedef struct Bytecode Bytecode;
+struct Bytecode {
+  Node *node;			/* what it computes */
+  int dest;			/* register(s) for the result */
+  int args[3];			/* registers of the arguments */
+  const unsigned *noise;	/* for mix and sprinkle */
+  Intensity *load;		/* cached tile(s) holding the result, if any */
+  Intensity *store;		/* tile(s) to keep a copy of the result in */
+};
+
+/* Everything one thread needs to compile and evaluate a program, so
+   that each worker can render tiles of its own at the same time. */
+typedef struct Workspace Workspace;
+struct Workspace {
+  /* All nodes live in this arena, allocated bottom-up. */
+  Node nodes[max_nodes];
+  int num_nodes;
+
+  /* An open-addressed hashtable of the nodes. A slot is empty unless
+     it's stamped with the current generation. */
+  struct {
+    Node *node;
+    unsigned generation;
+  } node_table[node_table_size];
+  unsigned generation;
+
+  /* The symbolic stack (see compile). */
+  int stack_ptr;
+  int image_serial;		/* the render_image run it's for, or 0 */
+  Node *r_stack[stack_limit];
+  Node *g_stack[stack_limit];
+  Node *b_stack[stack_limit];
+
+  /* The tile heap holds all intensity tiles. There's space for one 
+     RGB triple for each of 'program_length' instructions, plus one 
+     initial 'zero' tile. */
+  Intensity heap[3 * program_length * tile_size + 1];
+  Intensity *heap_ptr;
+
+  /* The program translated for fused evaluation: its code, a
+     register a chunk long for each node, and the noise for each mix
+     or sprinkle step. */
+  Bytecode code[max_nodes];
+  int code_length;
+  int num_registers;
+  Intensity registers[max_nodes][chunk_size];
+  unsigned noise[program_length][tile_size];
+  int noise_made[program_length];
+};
+
+static Workspace *workspaces[max_workers];
 
-/* Reclaim all nodes from the table. */
+/* The workspace of the current thread. */
+static __thread Workspace *ws = NULL;
+
+/* Make the current thread work in worker number 'worker's workspace. */
+static void
+use_workspace (int worker)
+{
+  if (workspaces[worker] == NULL)
+    {
+      workspaces[worker] = allot (sizeof *workspaces[worker]);
+      memset (workspaces[worker], 0, sizeof *workspaces[worker]);
+    }
+  ws = workspaces[worker];
+}
+
+/* Reclaim all nodes from the arena and the table. */
 static void
 free_all_nodes (void)
 {
-  int i;
-  for (i = 0; i < node_table_size; ++i)
+  ws->num_nodes = 0;
+  if (++ws->generation == 0)
     {
-      Node *q, *p;
-      for (p = node_table[i]; p != NULL; p = q)
-	{
-	  q = p->next;
-	  unallot (p);
-	}
-      node_table[i] = NULL;
+      memset (ws->node_table, 0, sizeof ws->node_table);
+      ws->generation = 1;
     }
 }
 
@@ -466,6 +827,22 @@ node_hash (Node *node)
   return h;
 }
 
+/* Compute another hash value for node, independent of node_hash, so
+   the pair of them can stand in for its structure. */
+static unsigned
+node_check (Node *node)
+{
+  unsigned h = scramble (node->type ^ (unsigned) (size_t) node->opcode);
+  int i;
+  for (i = 0; i < node->arity; ++i)
+    h = scramble (h + node->arguments[i]->checkcode);
+  if (node->type == constant)
+    h = scramble (h ^ intensity_to_bits (node->constant_value));
+  if (node->type == mix || node->type == sprinkle)
+    h = scramble (h ^ node->step);
+  return h;
+}
+
 /* Return true iff node1 and node2 are structurally equivalent. */
 static int
 node_equal (Node *node1, Node *node2)
@@ -483,33 +860,63 @@ node_equal (Node *node1, Node *node2)
      node1->step == node2->step);
 }
 
+/* Post: no node has a result, in either evaluator. */
+static void
+reset_results (void)
+{
+  int i;
+  for (i = 0; i < ws->num_nodes; ++i)
+    {
+      ws->nodes[i].result = NULL;
+      ws->nodes[i].reg = -1;
+    }
+}
+
 /* Return the unique node equal to 'node'. Add it to the table if not
-   in there already. */
+   in there already, keeping it in the arena; otherwise its arena slot
+   stays free for the next one.
+   Pre: 'node' is the next free slot of the arena. */
 static Node *
 uniquify (Node *node)
 {
-  Node **bucket = &node_table[node->hashcode % node_table_size];
-  Node *p;
-  for (p = *bucket; p != NULL; p = p->next)
-    if (node_equal (p, node))
-      {
-	unallot (node);
-	return p;
-      }
-  node->next = *bucket;
-  *bucket = node;
-  return node;
+  unsigned i = node->checkcode;
+  for (;; ++i)
+    {
+      i &= node_table_size - 1;
+      if (ws->node_table[i].generation != ws->generation)
+	{
+	  ws->node_table[i].node = node;
+	  ws->node_table[i].generation = ws->generation;
+	  ++ws->num_nodes;
+	  return node;
+	}
+      if (node_equal (ws->node_table[i].node, node))
+	return ws->node_table[i].node;
+    }
 }
 
-/* Post: no node has a computed intensity field. */
-static void
-reset_cache (void)
+/* Return roughly how long node's own op takes, in units of a cheap
+   op like + -- which is also about what it takes to copy a tile. */
+static int
+op_cost (Node *node)
 {
+  static Opcode *const slow_ops[] = {
+    op_atan, op_cos, op_exp, op_log, op_sin, op_tan, 
+    op_hypot, op_mod, op_pow
+  };
   int i;
-  Node *b;
-  for (i = 0; i < node_table_size; ++i)
-    for (b = node_table[i]; b != NULL; b = b->next)
-      b->result = NULL;
+  switch (node->type)
+    {
+    case constant: case part1: case part2:
+      return 0;
+    case mix: case sprinkle: case hwb:
+      return 4;
+    default:
+      for (i = 0; i < sizeof slow_ops / sizeof slow_ops[0]; ++i)
+	if (node->opcode == slow_ops[i])
+	  return 8;
+      return 1;
+    }
 }
 
 /* Return the unique node for the given arguments.
@@ -519,7 +926,10 @@ make_node (char *name, OpType type, Opcode opcode,
 	   int step, Intensity constant_value,
 	   int arity, Node *arg0, Node *arg1, Node *arg2)
 {
-  Node *node = allot (sizeof *node);
+  Node *node = &ws->nodes[ws->num_nodes];
+  int i;
+  if (max_nodes <= ws->num_nodes)
+    die ("bug");
   node->type = type;
   node->opcode = opcode;
   node->arity = arity;
@@ -530,8 +940,12 @@ make_node (char *name, OpType type, Opcode opcode,
   node->step = step;
   node->name = name;
   node->result = NULL;
+  node->reg = -1;
   node->hashcode = node_hash (node);
-  node->next = NULL;
+  node->checkcode = node_check (node);
+  node->cost = op_cost (node);
+  for (i = 0; i < arity; ++i)
+    node->cost += node->arguments[i]->cost;
   return uniquify (node);
 }
 
@@ -553,17 +967,11 @@ node_dump (Node *node)
   --indent;
 }
 
-/* The tile heap holds all intensity tiles. There's space for one 
-   RGB triple for each of 'program_length' instructions, plus one 
-   initial 'zero' tile. */
-static Intensity heap[3 * program_length * tile_size + 1];
-static Intensity *heap_ptr;
-
 /* Free all currently-allocated intensity tiles. */
 static void
 reset_heap (void)
 {
-  heap_ptr = heap;
+  ws->heap_ptr = ws->heap;
 }
 
 /* Allocate 'blocks' consecutive intensity tiles, starting at the
@@ -571,9 +979,221 @@ reset_heap (void)
 static void
 allocate (int blocks)
 {
-  if (heap_ptr - heap >= sizeof heap / sizeof heap[0])
+  if (ws->heap_ptr - ws->heap >= sizeof ws->heap / sizeof ws->heap[0])
     die ("bug");
-  heap_ptr += blocks * tile_size;
+  ws->heap_ptr += blocks * tile_size;
+}
+
+/* Nonzero to draw mix and sprinkle noise from ISAAC, reseeded for
+   every tile, exactly as evo always did -- so genomes saved back then
+   still render the same. Otherwise each (step, tile) gets a cheap
+   random stream of its own. */
+static int isaac_compat = 1;
+
+/* Fill noise[0..tile_size-1] with the random words for the mix or
+   sprinkle op at program step 'step', in tile 'tile_id'. */
+static void
+make_noise (unsigned *noise, int step, int tile_id)
+{
+  if (isaac_compat)
+    {
+      randctx r;
+      seed_isaac (&r, step + 64 * tile_id);
+      isaac_fill (&r, noise, tile_size);
+    }
+  else
+    {
+      Stream stream;
+      stream_init (&stream, step, tile_id);
+      stream_fill (&stream, noise, tile_size);
+    }
+}
+
+/* Tile cache
+   Evaluated tiles, shared by all programs and all workers, keyed by
+   the structure of the node that computed them and the tile they're
+   for. A mutant shares most of its graph with its parent, so when it's
+   generated only the nodes that changed need computing again. The
+   structure is known only by its two 32-bit hashes, so there's a
+   vanishingly small chance of a mixup. Tile ids already tell the
+   coordinate systems apart. */
+
+typedef struct Cached Cached;
+struct Cached {
+  unsigned hashcode, checkcode;
+  int tile_id;
+  int part;			/* which tile of a multi-tile result */
+  int mode;			/* see tile_cache_mode */
+  Cached *next;			/* The next entry in the hashtable bucket */
+  Cached *newer, *older;	/* Neighbors in order of last use */
+  Intensity tile[tile_size];
+};
+
+enum { tile_cache_buckets = 4099 };
+
+static Cached *tile_cache[tile_cache_buckets];
+static Cached *newest = NULL, *oldest = NULL;
+static int tiles_cached = 0;
+
+/* The most tiles to keep, at 4K each; 0 turns the cache off. */
+static int tile_cache_limit = 8192;
+
+/* Cache only results of nodes at least this costly (see op_cost). */
+static int tile_cache_min_cost = 8;
+
+static SDL_mutex *tile_cache_lock;
+
+/* Settings that change what the same node computes. */
+static INLINE int
+tile_cache_mode (void)
+{
+  return 2 * fast_math + isaac_compat;
+}
+
+static INLINE Cached **
+tile_cache_bucket (unsigned hashcode, int tile_id, int part)
+{
+  unsigned h = combine (combine (hashcode, tile_id), part);
+  return &tile_cache[h % tile_cache_buckets];
+}
+
+/* Return the entry for part 'part' of node's result in tile 'tile_id',
+   or NULL. Pre: tile_cache_lock is held. */
+static Cached *
+find_cached (Node *node, int tile_id, int part)
+{
+  int mode = tile_cache_mode ();
+  Cached *p = *tile_cache_bucket (node->hashcode, tile_id, part);
+  for (; p != NULL; p = p->next)
+    if (p->hashcode == node->hashcode && p->checkcode == node->checkcode
+	&& p->tile_id == tile_id && p->part == part && p->mode == mode)
+      return p;
+  return NULL;
+}
+
+static void
+unlink_used (Cached *p)
+{
+  if (p->newer) p->newer->older = p->older; else newest = p->older;
+  if (p->older) p->older->newer = p->newer; else oldest = p->newer;
+}
+
+static void
+link_newest (Cached *p)
+{
+  p->newer = NULL;
+  p->older = newest;
+  if (newest) newest->newer = p; else oldest = p;
+  newest = p;
+}
+
+/* Remove the least recently used entry and return it. */
+static Cached *
+evict_oldest (void)
+{
+  Cached *p = oldest;
+  Cached **q = tile_cache_bucket (p->hashcode, p->tile_id, p->part);
+  for (; *q != p; q = &(*q)->next)
+    ;
+  *q = p->next;
+  unlink_used (p);
+  --tiles_cached;
+  return p;
+}
+
+/* Copy the 'parts' tiles of node's result in tile 'tile_id' into dest,
+   if they're all cached, and return true iff they were. */
+static int
+fetch_tiles (Node *node, int tile_id, int parts, Intensity *dest)
+{
+  Cached *found[3];
+  int i;
+  if (tile_cache_limit <= 0)
+    return 0;
+  SDL_mutexP (tile_cache_lock);
+  for (i = 0; i < parts; ++i)
+    if (NULL == (found[i] = find_cached (node, tile_id, i)))
+      {
+	SDL_mutexV (tile_cache_lock);
+	return 0;
+      }
+  for (i = 0; i < parts; ++i)
+    {
+      memcpy (dest + i * tile_size, found[i]->tile, sizeof found[i]->tile);
+      unlink_used (found[i]);
+      link_newest (found[i]);
+    }
+  SDL_mutexV (tile_cache_lock);
+  return 1;
+}
+
+/* Remember the 'parts' tiles at src as node's result in tile 'tile_id',
+   making room by forgetting the least recently used. */
+static void
+store_tiles (Node *node, int tile_id, int parts, const Intensity *src)
+{
+  int i;
+  if (tile_cache_limit <= 0)
+    return;
+  SDL_mutexP (tile_cache_lock);
+  for (i = 0; i < parts; ++i)
+    {
+      Cached *p = find_cached (node, tile_id, i);
+      if (p != NULL)		/* Another worker just got here first. */
+	{
+	  unlink_used (p);
+	  link_newest (p);
+	  continue;
+	}
+      while (tile_cache_limit < tiles_cached)
+	unallot (evict_oldest ());
+      p = tile_cache_limit <= tiles_cached ? evict_oldest () 
+	                                   : allot (sizeof *p);
+      p->hashcode  = node->hashcode;
+      p->checkcode = node->checkcode;
+      p->tile_id   = tile_id;
+      p->part      = i;
+      p->mode      = tile_cache_mode ();
+      memcpy (p->tile, src + i * tile_size, sizeof p->tile);
+      {
+	Cached **bucket = tile_cache_bucket (node->hashcode, tile_id, i);
+	p->next = *bucket;
+	*bucket = p;
+      }
+      link_newest (p);
+      ++tiles_cached;
+    }
+  SDL_mutexV (tile_cache_lock);
+}
+
+/* Forget every cached tile. */
+static void
+flush_tile_cache (void)
+{
+  SDL_mutexP (tile_cache_lock);
+  while (oldest != NULL)
+    unallot (evict_oldest ());
+  SDL_mutexV (tile_cache_lock);
+}
+
+/* Return the number of tiles in the cache entries for node, or 0 if
+   it's not worth caching: copying a tile in and out costs about as
+   much as a few cheap ops. */
+static INLINE int
+cached_parts (Node *node)
+{
+  /* A picture of any old size won't be seen again. */
+  if (node->cost < tile_cache_min_cost || frame_cs == image)
+    return 0;
+  switch (node->type)
+    {
+    case opc0: case opc1: case opc2: case mix: case sprinkle:
+      return 1;
+    case hwb:
+      return 3;
+    default:
+      return 0;
+    }
 }
 
 /* Return the tile resulting from evaluating 'node' into the tile at 
@@ -581,37 +1201,47 @@ allocate (int blocks)
 static Intensity *
 eval (Node *node, int tile_id)
 {
-  Intensity *result = heap_ptr;
+  Intensity *result = ws->heap_ptr;
+  int parts = cached_parts (node);
   if (node->result != NULL)
     return node->result;
+  if (0 < parts && fetch_tiles (node, tile_id, parts, result))
+    {
+      allocate (parts);
+      node->result = result;
+      return result;
+    }
   switch (node->type)
     {
     case opc0:
       allocate (1);
-      node->opcode (result, NULL, NULL);
+      node->opcode (result, NULL, NULL, tile_size);
       break;
     case opc1:
       allocate (1);
-      node->opcode (result, eval (node->arguments[0], tile_id), NULL);
+      node->opcode (result, eval (node->arguments[0], tile_id), NULL,
+		    tile_size);
       break;
     case opc2:
       allocate (1);
       node->opcode (result, 
 		    eval (node->arguments[0], tile_id),
-		    eval (node->arguments[1], tile_id));
+		    eval (node->arguments[1], tile_id),
+		    tile_size);
       break;
     case mix:
       allocate (1);
       {
 	Intensity *arg0 = eval (node->arguments[0], tile_id);
 	Intensity *arg1 = eval (node->arguments[1], tile_id);
-	seed_rand (node->step + 64 * tile_id);
-	op_mix (result, arg0, arg1);
+	unsigned noise[tile_size];
+	make_noise (noise, node->step, tile_id);
+	op_mix (result, arg0, arg1, noise, tile_size);
       }
       break;
     case constant:
       allocate (1);
-      op_constant (node->constant_value, result);
+      op_constant (node->constant_value, result, tile_size);
       break;
     case color:
     case rotcolor:
@@ -619,10 +1249,12 @@ eval (Node *node, int tile_id)
       break;
     case hwb:
       allocate (3);
-      op_hwb_color (result, result + tile_size, result + 2 * tile_size,
-		    eval (node->arguments[0], tile_id), 
-		    eval (node->arguments[1], tile_id), 
-		    eval (node->arguments[2], tile_id));
+      (fast_math ? fast_hwb_color : op_hwb_color)
+	(result, result + tile_size, result + 2 * tile_size,
+	 eval (node->arguments[0], tile_id), 
+	 eval (node->arguments[1], tile_id), 
+	 eval (node->arguments[2], tile_id),
+	 tile_size);
       break;
     case part1:
       result = eval (node->arguments[0], tile_id) + 1 * tile_size;
@@ -634,30 +1266,35 @@ eval (Node *node, int tile_id)
       allocate (1);
       {
 	Intensity *arg0 = eval (node->arguments[0], tile_id);
-	seed_rand (node->step + 64 * tile_id);
-	op_sprinkle (result, arg0);
+	unsigned noise[tile_size];
+	make_noise (noise, node->step, tile_id);
+	op_sprinkle (result, arg0, noise, tile_size);
       }
       break;
     default: 
       assert (0);
     }
+  if (0 < parts)
+    store_tiles (node, tile_id, parts, result);
   node->result = result;
   return result;
 }
 
-typedef enum { small, big } Coord_system;
-
-enum {
-  tile_ids = thumb_rows*thumb_cols + rows*cols
-};
+/* The size of the picture render_image is making, in pixels and in
+   tiles across. */
+static int image_width, image_height, image_tiles_across;
 
-/* Return the tile resulting from evaluating 'node' into the tile
-   at cs:(col,row). */
-static Intensity *
-evaluate (Node *node, Coord_system cs, int col, int row)
+/* Set up the current thread to evaluate the tile at cs:(col,row),
+   and return its tile id. */
+static int
+set_frame (Coord_system cs, int col, int row)
 {
   int tile_id;
-  double aspect = (double)thumb_width / thumb_height;
+  /* (With no grid laid out, as in batch rendering, a thumbnail is
+     thumb_cols x thumb_rows tiles.) */
+  double aspect = thumb_height != 0
+    ? (double)thumb_width / thumb_height
+    : (double)(thumb_cols*tile_width) / (thumb_rows*tile_height);
   if (cs == small)
     {
       left    = -aspect + (2*aspect/thumb_cols) * col;
@@ -674,10 +1311,208 @@ evaluate (Node *node, Coord_system cs, int col, int row)
       y_scale = 2.0/(tile_height*rows*thumb_rows);
       tile_id = thumb_rows*thumb_cols + row * cols*thumb_cols + col;
     }
+  else if (cs == image)
+    {
+      /* The same picture as big's, stretched over the image. (Written
+	 the same way as big's, so at the grid's size the pixels are
+	 the same.) */
+      left    = -aspect + (2*aspect/((double)image_width/tile_width)) * col;
+      top     = -1.0 + (2.0/((double)image_height/tile_height)) * row;
+      x_scale = 2*aspect/image_width;
+      y_scale = 2.0/image_height;
+      tile_id = thumb_rows*thumb_cols + row * image_tiles_across + col;
+    }
+  else if (cs == preview)
+    {
+      left    = -aspect;
+      top     = -1.0;
+      x_scale = 2*aspect*thumb_cols/thumb_width;
+      y_scale = 2.0*thumb_rows/thumb_height;
+      tile_id = -1;
+    }
   else
     assert (0);
+  frame_cs = cs;
+  first_pixel = 0;
+  return tile_id;
+}
 
-  return eval (node, tile_id);
+/* Return the tile resulting from evaluating 'node' into the tile
+   at cs:(col,row). */
+static Intensity *
+evaluate (Node *node, Coord_system cs, int col, int row)
+{
+  return eval (node, set_frame (cs, col, row));
+}
+
+
+/* Fused evaluation
+   Evaluating a node at a time makes a pass over a whole tile for every
+   op. Instead this translates the graph into a bytecode for a machine
+   with a register per node, each just a chunk of pixels long, and runs
+   the whole program over one chunk of the tile at a time. Intermediate
+   results then stay in the L1 cache. Shared subexpressions still get
+   computed once, and each op computes exactly what it would a tile at
+   a time, so the pictures are the same. The tile cache works as
+   before: a cached node gets loaded rather than computed, and a node
+   worth caching gets its result copied out as it goes. */
+
+/* Nonzero to evaluate by fused chunks rather than whole tiles. */
+static int fused = 1;
+
+/* Return the first of n new registers. */
+static int
+new_registers (int n)
+{
+  int r = ws->num_registers;
+  if (max_nodes < r + n)
+    die ("bug");
+  ws->num_registers += n;
+  return r;
+}
+
+/* Return the register that will hold node's value, adding code to
+   compute it in tile 'tile_id' after the code for its arguments. */
+static int
+translate (Node *node, int tile_id)
+{
+  Bytecode b;
+  int i, parts = cached_parts (node);
+  if (0 <= node->reg)
+    return node->reg;
+  switch (node->type)
+    {
+    case part1:
+      return node->reg = translate (node->arguments[0], tile_id) + 1;
+    case part2:
+      return node->reg = translate (node->arguments[0], tile_id) + 2;
+    case constant:
+      node->reg = new_registers (1);
+      op_constant (node->constant_value, ws->registers[node->reg], 
+		   chunk_size);
+      return node->reg;
+    default:
+      break;
+    }
+
+  b.node = node;
+  b.noise = NULL;
+  b.load = b.store = NULL;
+  if (0 < parts && fetch_tiles (node, tile_id, parts, ws->heap_ptr))
+    {
+      b.load = ws->heap_ptr;
+      allocate (parts);
+    }
+  else
+    {
+      for (i = 0; i < node->arity; ++i)
+	b.args[i] = translate (node->arguments[i], tile_id);
+      if (node->type == mix || node->type == sprinkle)
+	{
+	  if (!ws->noise_made[node->step])
+	    {
+	      make_noise (ws->noise[node->step], node->step, tile_id);
+	      ws->noise_made[node->step] = 1;
+	    }
+	  b.noise = ws->noise[node->step];
+	}
+      if (0 < parts)
+	{
+	  b.store = ws->heap_ptr;
+	  allocate (parts);
+	}
+    }
+  b.dest = node->reg = new_registers (node->type == hwb ? 3 : 1);
+  ws->code[ws->code_length++] = b;
+  return node->reg;
+}
+
+/* Run the translated code on the pixels of the current tile from
+   first_pixel on. */
+static void
+run_fused (void)
+{
+  Intensity (*R)[chunk_size] = ws->registers;
+  int k, i, first = first_pixel;
+  for (k = 0; k < ws->code_length; ++k)
+    {
+      const Bytecode *p = &ws->code[k];
+      int parts = p->node->type == hwb ? 3 : 1;
+      if (p->load != NULL)
+	{
+	  for (i = 0; i < parts; ++i)
+	    memcpy (R[p->dest + i], p->load + i * tile_size + first, 
+		    sizeof R[0]);
+	  continue;
+	}
+      switch (p->node->type)
+	{
+	case opc0:
+	  p->node->opcode (R[p->dest], NULL, NULL, chunk_size);
+	  break;
+	case opc1:
+	  p->node->opcode (R[p->dest], R[p->args[0]], NULL, chunk_size);
+	  break;
+	case opc2:
+	  p->node->opcode (R[p->dest], R[p->args[0]], R[p->args[1]], 
+			   chunk_size);
+	  break;
+	case mix:
+	  op_mix (R[p->dest], R[p->args[0]], R[p->args[1]], 
+		  p->noise + first, chunk_size);
+	  break;
+	case sprinkle:
+	  op_sprinkle (R[p->dest], R[p->args[0]], p->noise + first, 
+		       chunk_size);
+	  break;
+	case hwb:
+	  (fast_math ? fast_hwb_color : op_hwb_color)
+	    (R[p->dest], R[p->dest + 1], R[p->dest + 2],
+	     R[p->args[0]], R[p->args[1]], R[p->args[2]], 
+	     chunk_size);
+	  break;
+	default:
+	  assert (0);
+	}
+      if (p->store != NULL)
+	for (i = 0; i < parts; ++i)
+	  memcpy (p->store + i * tile_size + first, R[p->dest + i], 
+		  sizeof R[0]);
+    }
+}
+
+/* Evaluate the RGB triple of nodes 'tos' into the tile at
+   cs:(col,row), leaving the results in 'out'. */
+static void
+evaluate_fused (Node **tos, Coord_system cs, int col, int row, 
+		Intensity **out)
+{
+  int tile_id = set_frame (cs, col, row);
+  int regs[3], c, k;
+
+  ws->code_length = 0;
+  ws->num_registers = 0;
+  memset (ws->noise_made, 0, sizeof ws->noise_made);
+  for (c = 0; c < 3; ++c)
+    regs[c] = translate (tos[c], tile_id);
+  for (c = 0; c < 3; ++c)
+    {
+      out[c] = ws->heap_ptr;
+      allocate (1);
+    }
+
+  for (first_pixel = 0; first_pixel < tile_size; first_pixel += chunk_size)
+    {
+      run_fused ();
+      for (c = 0; c < 3; ++c)
+	memcpy (out[c] + first_pixel, ws->registers[regs[c]], 
+		sizeof ws->registers[0]);
+    }
+
+  for (k = 0; k < ws->code_length; ++k)
+    if (ws->code[k].store != NULL)
+      store_tiles (ws->code[k].node, tile_id, 
+		   cached_parts (ws->code[k].node), ws->code[k].store);
 }
 
 
@@ -751,12 +1586,7 @@ struct Instruc {
 /* The symbolic stack represents the state produced by executing a sequence
    of instructions, as a node graph with a node for each RGB component at 
    each possible stack slot. You produce an image by evaluating the
-   nodes for the top-of-stack. */
-static int stack_ptr = 0;
-
-static Node *r_stack[stack_limit];
-static Node *g_stack[stack_limit];
-static Node *b_stack[stack_limit];
+   nodes for the top-of-stack. It lives in the Workspace. */
 
 /* Initialize the symbolic stack. */
 static void
@@ -764,12 +1594,12 @@ clear_stack (void)
 {
   int i;
   Node *zero = make_node ("0", constant, NULL, 0, 0.0, 0, NULL, NULL, NULL);
-  stack_ptr = 0;
+  ws->stack_ptr = 0;
   for (i = 0; i < stack_limit; ++i)
     {
-      r_stack[i] = zero;
-      g_stack[i] = zero;
-      b_stack[i] = zero;
+      ws->r_stack[i] = zero;
+      ws->g_stack[i] = zero;
+      ws->b_stack[i] = zero;
     }
 }
 
@@ -863,39 +1693,41 @@ really_pretend (Instruc *p,
 static void
 pretend (Instruc *p, int step)
 {
-  stack_ptr = bump (stack_ptr, -p->pops);
+  ws->stack_ptr = bump (ws->stack_ptr, -p->pops);
   {
     Node **tos[] = { 
-      &r_stack[stack_ptr], 
-      &g_stack[stack_ptr], 
-      &b_stack[stack_ptr]
+      &ws->r_stack[ws->stack_ptr], 
+      &ws->g_stack[ws->stack_ptr], 
+      &ws->b_stack[ws->stack_ptr]
     };
     Node **nos[] = { 
-      &r_stack[bump (stack_ptr, 1)],
-      &g_stack[bump (stack_ptr, 1)],
-      &b_stack[bump (stack_ptr, 1)]
+      &ws->r_stack[bump (ws->stack_ptr, 1)],
+      &ws->g_stack[bump (ws->stack_ptr, 1)],
+      &ws->b_stack[bump (ws->stack_ptr, 1)]
     };
     Node **pos[] = { 
-      &r_stack[bump (stack_ptr, 2)],
-      &g_stack[bump (stack_ptr, 2)],
-      &b_stack[bump (stack_ptr, 2)]
+      &ws->r_stack[bump (ws->stack_ptr, 2)],
+      &ws->g_stack[bump (ws->stack_ptr, 2)],
+      &ws->b_stack[bump (ws->stack_ptr, 2)]
     };
     really_pretend (p, tos, nos, pos, step);
   }
-  stack_ptr = bump (stack_ptr, p->pushes);
+  ws->stack_ptr = bump (ws->stack_ptr, p->pushes);
 }
 
 /* Symbolically evaluate 'program', leaving a graph representation of
-   it in the symbolic stack. */
+   it in the symbolic stack, in place of any earlier one. */
 static void
 compile (Instruc *program)
 {
   int i;
+  free_all_nodes ();
+  ws->image_serial = 0;
   clear_stack ();
   for (i = 0; program[i].type != end; ++i)
     pretend (&program[i], i);
   assert (i < program_length);
-  stack_ptr = bump (stack_ptr, -1);
+  ws->stack_ptr = bump (ws->stack_ptr, -1);
 }
 
 
@@ -1062,15 +1894,16 @@ write_program (FILE *out, Instruc *pgm, int length)
 }
 
 /* Read 'pgm' from 'in'. It must have exactly 'length' instructions.
+   Return false, leaving pgm alone, if 'in' has run out.
    FIXME make this more flexible */
-static void
+static int
 read_program (FILE *in, Instruc *pgm, int length)
 {
   int i, in_length;
   if (1 != fscanf (in, "%d", &in_length))
     {
       if (feof (in))
-	return;
+	return 0;
       die ("Bad data in evo-state: %s", strerror (errno));
     }
   if (in_length != length-1)
@@ -1078,13 +1911,26 @@ read_program (FILE *in, Instruc *pgm, int length)
   for (i = 0; i < length-1; ++i)
     pgm[i] = read_instruc (in);
   pgm[length-1].type = end;
+  return 1;
 }
 
 
 /* Thumbnail cache */
 
-static Pixel thumbnail_cache[grid_size];
-static int cache_valid[cols][rows];
+static Pixel *thumbnail_cache = NULL;
+static int *cache_valid = NULL;	/* indexed by col * rows + row */
+static unsigned *thumb_hashes = NULL; /* of the cached pixels, likewise */
+
+/* What compiling each program showed, also cached per program: the
+   size of its graph, and a fingerprint of the graph's structure --
+   programs with the same fingerprint make the same picture. */
+typedef struct Analysis Analysis;
+struct Analysis {
+  int valid;
+  int complexity;
+  unsigned fingerprint[2];
+};
+static Analysis *analyses = NULL;
 
 static void
 copy_grid_square (Uint32 *dest, const Uint32 *src, int col, int row)
@@ -1104,19 +1950,39 @@ static void
 copy_to_grid (int col, int row)
 {
   copy_grid_square (grid, thumbnail_cache, col, row);
+  mark_dirty (col * thumb_width, row * thumb_height, 
+	      thumb_width, thumb_height);
+}
+
+/* Return a hash of the cached thumbnail (col, row). */
+static unsigned
+hash_thumb (int col, int row)
+{
+  int x0 = col * thumb_width;
+  int y0 = row * thumb_height;
+  int x, y;
+  unsigned h = 0;
+  for (y = y0; y < y0 + thumb_height; ++y)
+    for (x = x0; x < x0 + thumb_width; ++x)
+      h = scramble (h ^ thumbnail_cache[y * grid_width + x]);
+  return h;
 }
 
 static void
 update_cache (int col, int row)
 {
   copy_grid_square (thumbnail_cache, grid, col, row);
-  cache_valid[col][row] = 1;
+  cache_valid[col * rows + row] = 1;
+  thumb_hashes[col * rows + row] = hash_thumb (col, row);
 }
 
+/* Forget the picture of program (col, row) and anything else known
+   about it, because it's changed. */
 static void
 invalidate_cache (int col, int row)
 {
-  cache_valid[col][row] = 0;
+  cache_valid[col * rows + row] = 0;
+  analyses[col * rows + row].valid = 0;
 }
 
 
@@ -1124,12 +1990,67 @@ invalidate_cache (int col, int row)
 
 /* The instructions for each program. 
    FIXME give a name to this concept of a visible choice */
-static Instruc programs[cols][rows][program_length];
+static Instruc (*programs)[program_length] = NULL;
+
+/* Return the instructions of program (col, row). */
+static INLINE Instruc *
+program_at (int col, int row)
+{
+  return programs[col * rows + row];
+}
+
+/* Fit the thumbnails to a newly made grid, and start over with a
+   blank slate of programs. */
+static void
+lay_out (void)
+{
+  cols = grid_width / (tile_width*thumb_cols);
+  rows = grid_height / (tile_height*thumb_rows);
+  flush_tile_cache ();
+
+  unallot (thumbnail_cache);
+  unallot (cache_valid);
+  unallot (thumb_hashes);
+  unallot (analyses);
+  unallot (programs);
+  thumbnail_cache = NULL;
+  cache_valid = NULL;
+  thumb_hashes = NULL;
+  analyses = NULL;
+  programs = NULL;
+  /* Other hacks make grids too small for a thumbnail; that's only an
+     error if we're asked to draw one (see check_coords). */
+  if (cols == 0 || rows == 0)
+    {
+      cols = rows = 0;
+      thumb_width = thumb_height = 0;
+      return;
+    }
+  thumb_width  = grid_width / cols;
+  thumb_height = grid_height / rows;
+  thumbnail_cache = allot (grid_size * sizeof thumbnail_cache[0]);
+  cache_valid = allot (cols * rows * sizeof cache_valid[0]);
+  thumb_hashes = allot (cols * rows * sizeof thumb_hashes[0]);
+  analyses = allot (cols * rows * sizeof analyses[0]);
+  programs = allot (cols * rows * sizeof programs[0]);
+  memset (cache_valid, 0, cols * rows * sizeof cache_valid[0]);
+  memset (analyses, 0, cols * rows * sizeof analyses[0]);
+  memset (programs, 0, cols * rows * sizeof programs[0]);
+}
+
+/* Require the grid to hold at least one thumbnail. */
+static void
+check_room (void)
+{
+  if (cols == 0)
+    die ("The grid is too small to hold even one thumbnail");
+}
 
 /* Require col and row to be in range. */
 static void
 check_coords (int col, int row)
 {
+  check_room ();
   if (col < 0 || cols <= col)
     die ("Bad column: %d\n", col);
   if (row < 0 || rows <= row)
@@ -1141,7 +2062,7 @@ static void
 populate (int col, int row)
 {
   check_coords (col, row);
-  randomize (programs[col][row], program_length);
+  randomize (program_at (col, row), program_length);
   invalidate_cache (col, row);
 }
 
@@ -1150,7 +2071,7 @@ static void
 sample (int col, int row)
 {
   check_coords (col, row);
-  mutate (programs[col][row], program_length);
+  mutate (program_at (col, row), program_length);
   invalidate_cache (col, row);
 }
 
@@ -1160,52 +2081,146 @@ copy (int col1, int row1, int col2, int row2)
 {
   check_coords (col1, row1);
   check_coords (col2, row2);
-  memcpy (programs[col1][row1], 
-	  programs[col2][row2], 
-	  sizeof programs[col1][row1]);
+  memcpy (program_at (col1, row1), 
+	  program_at (col2, row2), 
+	  sizeof programs[0]);
   invalidate_cache (col1, row1);
 }
 
+/* Evaluate the compiled program into the tile at cs:(col,row), leaving
+   its RGB results in 'out'. */
+static void
+evaluate_tile (Coord_system cs, int col, int row, Intensity **out)
+{
+  Node *tos[] = { 
+    ws->r_stack[ws->stack_ptr], 
+    ws->g_stack[ws->stack_ptr], 
+    ws->b_stack[ws->stack_ptr]
+  };
+  int c;
+  reset_heap ();
+  if (fused)
+    evaluate_fused (tos, cs, col, row, out);
+  else
+    for (c = 0; c < 3; ++c)
+      out[c] = evaluate (tos[c], cs, col, row);
+}
+
 /* Generate image tile (grid_col, grid_row) for 'program' sector
    cs:(col,row). [or something. FIXME document this properly] */
 static void
 generate_grid (Instruc *program, Coord_system cs, int col, int row,
 	       int grid_col, int grid_row)
 {
-  free_all_nodes ();
+  Intensity *out[3];
   compile (program);
-  reset_cache ();
-  reset_heap ();
-  {
-    Intensity *tos[] = { 
-      evaluate (r_stack[stack_ptr], cs, col, row),
-      evaluate (g_stack[stack_ptr], cs, col, row),
-      evaluate (b_stack[stack_ptr], cs, col, row)
-    };
-    gridify (tos, grid_col * tile_width, grid_row * tile_height);
-  }
+  evaluate_tile (cs, col, row, out);
+  gridify (out, grid_col * tile_width, grid_row * tile_height);
+}
+
+/* Job: generate tile number 'index' of a list of thumbnails, each
+   given by its programs[] index in 'data'. */
+static void
+thumbnail_tile_job (void *data, int index, int worker)
+{
+  const int *thumbs = data;
+  int tiles = thumb_cols * thumb_rows;
+  int t = thumbs[index / tiles];
+  int col = t / rows, row = t % rows;
+  int i = index % tiles % thumb_cols;
+  int j = index % tiles / thumb_cols;
+  use_workspace (worker);
+  generate_grid (program_at (col, row), small, i, j,
+		 col * thumb_cols + i, row * thumb_rows + j);
+}
+
+/* Generate and cache the n thumbnails listed in 'thumbs', all their
+   tiles at once across the workers. */
+static void
+generate_thumbnails (int *thumbs, int n)
+{
+  int k;
+  run_jobs (thumbnail_tile_job, thumbs, n * thumb_cols * thumb_rows);
+  for (k = 0; k < n; ++k)
+    update_cache (thumbs[k] / rows, thumbs[k] % rows);
 }
 
 /* Generate the thumbnail image for program (col, row). */
 static void
 generate (int col, int row)
 {
-  int i, j;
+  int t = col * rows + row;
   check_coords (col, row);
-  if (cache_valid[col][row])
+  if (cache_valid[t])
     {
       copy_to_grid (col, row);
       return;
     }
-  invalidate_cache (col, row);
-  for (i = 0; i < thumb_cols; ++i)
-    for (j = 0; j < thumb_rows; ++j)
-      {
-	int c = col * thumb_cols + i;
-	int r = row * thumb_rows + j;
-	generate_grid (programs[col][row], small, i, j, c, r);
-      }
-  update_cache (col, row);
+  generate_thumbnails (&t, 1);
+}
+
+/* Generate every thumbnail that isn't cached already, in parallel. 
+   This leaves the rest of the grid alone: follow up with generate to
+   show them all. */
+static void
+generate_all (void)
+{
+  int *thumbs = allot (cols * rows * sizeof thumbs[0]);
+  int t, n = 0;
+  check_room ();
+  for (t = 0; t < cols * rows; ++t)
+    if (!cache_valid[t])
+      thumbs[n++] = t;
+  generate_thumbnails (thumbs, n);
+  unallot (thumbs);
+}
+
+/* Job: preview the thumbnail given by the programs[] index at 'index'
+   in 'data', in one tile blown up to fill it. */
+static void
+preview_job (void *data, int index, int worker)
+{
+  const int *thumbs = data;
+  int col = thumbs[index] / rows, row = thumbs[index] % rows;
+  Intensity *out[3];
+  use_workspace (worker);
+  compile (program_at (col, row));
+  evaluate_tile (preview, 0, 0, out);
+  gridify_blocks (out, col * thumb_cols * tile_width, 
+		  row * thumb_rows * tile_height, thumb_cols, thumb_rows);
+}
+
+/* Draw a quick preview of every thumbnail that isn't cached, at
+   1/thumb_cols the resolution, for about the cost of one tile each.
+   They stay uncached, for generate to fill in properly later. */
+static void
+preview_all (void)
+{
+  int *thumbs = allot (cols * rows * sizeof thumbs[0]);
+  int t, n = 0;
+  check_room ();
+  for (t = 0; t < cols * rows; ++t)
+    if (!cache_valid[t])
+      thumbs[n++] = t;
+  run_jobs (preview_job, thumbs, n);
+  unallot (thumbs);
+}
+
+typedef struct Sector Sector;
+struct Sector {
+  Instruc *program;
+  int col, row;
+};
+
+/* Job: generate tile number 'index' of the Sector 'data'. */
+static void
+sector_tile_job (void *data, int index, int worker)
+{
+  const Sector *sector = data;
+  int c = sector->col * thumb_cols + index % thumb_cols;
+  int r = sector->row * thumb_rows + index / thumb_cols;
+  use_workspace (worker);
+  generate_grid (sector->program, big, c, r, c, r);
 }
 
 /* Generate the sector at (col, row) of the full image for
@@ -1213,15 +2228,38 @@ generate (int col, int row)
 static void
 generate_big (int pcol, int prow, int col, int row)
 {
-  int i, j;
+  Sector sector;
+  check_coords (pcol, prow);
   check_coords (col, row);
-  for (i = 0; i < thumb_cols; ++i)
-    for (j = 0; j < thumb_rows; ++j)
-      {
-	int c = col * thumb_cols + i;
-	int r = row * thumb_rows + j;
-	generate_grid (programs[pcol][prow], big, c, r, c, r);
-      }
+  sector.program = program_at (pcol, prow);
+  sector.col = col;
+  sector.row = row;
+  run_jobs (sector_tile_job, &sector, thumb_cols * thumb_rows);
+}
+
+/* Return what compiling program (col, row) shows, compiling it only
+   if it's changed since last time. */
+static Analysis *
+analyze (int col, int row)
+{
+  Analysis *a = &analyses[col * rows + row];
+  if (!a->valid)
+    {
+      Node *r, *g, *b;
+      use_workspace (0);
+      compile (program_at (col, row));
+      r = ws->r_stack[ws->stack_ptr];
+      g = ws->g_stack[ws->stack_ptr];
+      b = ws->b_stack[ws->stack_ptr];
+      a->complexity = count_reachable_nodes (r, g, b);
+      a->fingerprint[0] = combine (combine (r->hashcode, g->hashcode), 
+				   b->hashcode);
+      a->fingerprint[1] = scramble (scramble (scramble (r->checkcode) 
+					      + g->checkcode) 
+				    + b->checkcode);
+      a->valid = 1;
+    }
+  return a;
 }
 
 /* Return a measure of the complexity of the program at (col,row):
@@ -1230,18 +2268,44 @@ static int
 complexity (int col, int row)
 {
   check_coords (col, row);
-  compile (programs[col][row]);
-  return count_reachable_nodes (r_stack[stack_ptr], 
-				g_stack[stack_ptr], 
-				b_stack[stack_ptr]);
+  return analyze (col, row)->complexity;
 }
 
-/* Return true iff grid images g and h are identical. */
+/* Return true iff programs g and h compile to the same graph, and so
+   make the same picture -- without rendering either. */
+static int
+same_genes (int gc, int gr, int hc, int hr)
+{
+  Analysis *g, *h;
+  check_coords (gc, gr);
+  check_coords (hc, hr);
+  g = analyze (gc, gr);
+  h = analyze (hc, hr);
+  return g->fingerprint[0] == h->fingerprint[0] 
+      && g->fingerprint[1] == h->fingerprint[1] ? -1 : 0;
+}
+
+/* Return true iff thumbnails g and h are identical: their cached
+   pictures if they're both cached, else what's on the grid. */
 static int
 same_thumbs (int gc, int gr, int hc, int hr)
 {
   check_coords (gc, gr);
   check_coords (hc, hr);
+  if (cache_valid[gc * rows + gr] && cache_valid[hc * rows + hr])
+    {
+      int gx0 = gc * thumb_width, gy0 = gr * thumb_height;
+      int hx0 = hc * thumb_width, hy0 = hr * thumb_height;
+      int y;
+      if (thumb_hashes[gc * rows + gr] != thumb_hashes[hc * rows + hr])
+	return 0;
+      for (y = 0; y != thumb_height; ++y)
+	if (0 != memcmp (thumbnail_cache + (gy0 + y) * grid_width + gx0,
+			 thumbnail_cache + (hy0 + y) * grid_width + hx0,
+			 thumb_width * sizeof thumbnail_cache[0]))
+	  return 0;
+      return -1;
+    }
   {
     int gx0 = gc * thumb_width;
     int gy0 = gr * thumb_height;
@@ -1269,7 +2333,7 @@ write_state (FILE *out)
   int i, j;
   for (j = 0; j < rows; ++j)
     for (i = 0; i < cols; ++i)
-      write_program (out, programs[i][j], program_length);
+      write_program (out, program_at (i, j), program_length);
 }
 
 /* Read every program from 'in'. */
@@ -1280,7 +2344,7 @@ read_state (FILE *in)
   for (j = 0; j < rows; ++j)
     for (i = 0; i < cols; ++i)
       {
-	read_program (in, programs[i][j], program_length);
+	read_program (in, program_at (i, j), program_length);
 	invalidate_cache (i, j);
       }
 }
@@ -1296,7 +2360,7 @@ read_random (FILE *in, int lines)
 	{
 	  int i = (rows * cols - n) % cols;
 	  int j = (rows * cols - n) / cols;
-	  read_program (in, programs[i][j], program_length);
+	  read_program (in, program_at (i, j), program_length);
 	  invalidate_cache (i, j);
 	  --n;
 	}
@@ -1329,7 +2393,7 @@ append1 (void)
     fprintf (stderr, "evo-saved: %s\n", strerror (errno));
   else
     {
-      write_program (out, programs[0][0], program_length);
+      write_program (out, program_at (0, 0), program_length);
       fclose (out);
       printf ("Appended 1 to evo-saved\n");
     }
@@ -1401,22 +2465,30 @@ open_file (const char *filename, const char *mode)
   return file;
 }
 
-/* Write the grid to out as a PPM file. */
+/* Write the header of a width x height PPM file of the picture made
+   by 'program'. */
 static void
-output_picture (FILE *out)
+output_header (FILE *out, Instruc *program, int width, int height)
 {
   fprintf (out, "P6\n");
   fprintf (out, "# Generated by evo\n");
 
   fprintf (out, "# ");
-  write_program (out, programs[0][0], program_length);
+  write_program (out, program, program_length);
 
-  fprintf (out, "%d %d 255\n", grid_width, grid_height);
+  fprintf (out, "%d %d 255\n", width, height);
+}
+
+/* Write the grid to out as a PPM file. */
+static void
+output_picture (FILE *out)
+{
+  output_header (out, program_at (0, 0), grid_width, grid_height);
   {
+    Uint8 *buffer = allot (3*grid_width);
     int i, j;
     for (i = 0; i < grid_height; ++i)
       {
-	Uint8 buffer[3*grid_width];
 	for (j = 0; j < grid_width; ++j) 
 	  {
 	    Uint32 pixel = grid[i * grid_width + j];
@@ -1427,12 +2499,13 @@ output_picture (FILE *out)
 	    buffer[3*j+1] = g;
 	    buffer[3*j+2] = b;
 	  }
-	if (1 != fwrite (buffer, sizeof buffer, 1, out))
+	if (1 != fwrite (buffer, 3*grid_width, 1, out))
 	  {
 	    printf ("Error writing image: %s\n", strerror (errno));
-	    return;
+	    break;
 	  }
       }
+    unallot (buffer);
   }
 }
 
@@ -1452,6 +2525,127 @@ save_image (void)
     }
 }
 
+/* One strip of tiles across a picture render_image is making. */
+typedef struct Image_strip Image_strip;
+struct Image_strip {
+  Instruc *program;
+  int serial;			/* which render_image run this is */
+  int row;			/* in tiles */
+  Uint8 *rgb;			/* RGB bytes for the whole strip */
+  int stride;			/* bytes per row of rgb */
+};
+
+/* Job: render tile number 'index' of the Image_strip 'data', compiling
+   the program only the first time this worker sees it. */
+static void
+image_tile_job (void *data, int index, int worker)
+{
+  Image_strip *strip = data;
+  Intensity *out[3];
+  use_workspace (worker);
+  if (ws->image_serial == strip->serial)
+    reset_results ();
+  else
+    {
+      compile (strip->program);
+      ws->image_serial = strip->serial;
+    }
+  evaluate_tile (image, index, strip->row, out);
+  rgbify (out, strip->rgb + 3 * tile_width * index, strip->stride);
+}
+
+/* Write the picture made by 'program' at width x height to 'out' as a
+   PPM file. Only one strip of tiles is in memory at a time, so the
+   size can be anything. */
+static void
+output_image (FILE *out, Instruc *program, int width, int height)
+{
+  static int serial = 0;
+  Image_strip strip;
+  int tiles_down, y;
+
+  if (width <= 0 || height <= 0)
+    die ("Bad image size: %d x %d", width, height);
+  image_width  = width;
+  image_height = height;
+  image_tiles_across = (width + tile_width - 1) / tile_width;
+  tiles_down = (height + tile_height - 1) / tile_height;
+
+  strip.program = program;
+  strip.serial  = ++serial;
+  strip.stride  = 3 * tile_width * image_tiles_across;
+  strip.rgb     = allot (strip.stride * tile_height);
+
+  output_header (out, program, width, height);
+  for (strip.row = 0; strip.row < tiles_down; ++strip.row)
+    {
+      run_jobs (image_tile_job, &strip, image_tiles_across);
+      for (y = 0; y < tile_height && strip.row * tile_height + y < height; ++y)
+	if (1 != fwrite (strip.rgb + y * strip.stride, 3 * width, 1, out))
+	  {
+	    printf ("Error writing image: %s\n", strerror (errno));
+	    strip.row = tiles_down;
+	    break;
+	  }
+    }
+  unallot (strip.rgb);
+}
+
+/* Render program (col, row) at width x height straight to the file
+   evoNN.ppm for the next available NN, without the grid. */
+static void
+render_image (int col, int row, int width, int height)
+{
+  char filename[PATH_MAX];
+  FILE *f;
+  check_coords (col, row);
+  f = open_save_file (filename, "evo%d.ppm", "wb");
+  if (f == NULL)
+    fprintf (stderr, "Couldn't open image file: %s\n", strerror (errno));
+  else
+    {
+      output_image (f, program_at (col, row), width, height);
+      fclose (f);
+      printf ("Image written to %s\n", filename);
+    }
+}
+
+/* Render every genome in the file 'genomes' (in the format of
+   evo-saved) at width x height, writing genome number n, counting
+   from 0, to the PPM file named by the printf format 'format' and n.
+   Each file carries its genome in a comment, the same as save-image's.
+   Return the number rendered. */
+int
+render_genomes (const char *genomes, int width, int height, 
+		const char *format)
+{
+  Instruc program[program_length];
+  FILE *in = open_file (genomes, "r");
+  int n;
+  for (n = 0; read_program (in, program, program_length); ++n)
+    {
+      char filename[PATH_MAX];
+      FILE *out;
+      snprintf (filename, sizeof filename, format, n);
+      out = open_file (filename, "wb");
+      output_image (out, program, width, height);
+      if (fclose (out) != 0)
+	die ("%s: %s", filename, strerror (errno));
+      printf ("%s\n", filename);
+    }
+  fclose (in);
+  return n;
+}
+
+/* Tusl word: render-genomes ( genomes width height format -- ) */
+static void
+render_genomes_word (const char *genomes, int width, int height, 
+		     const char *format)
+{
+  printf ("%d images rendered\n", 
+	  render_genomes (genomes, width, height, format));
+}
+
 /* Regenerate the image program from file regress-state, 
    writing the image to regress-out. */
 static void
@@ -1463,6 +2657,7 @@ regress (void)
     read_state (in);
     fclose (in);
   }
+  generate_all ();
   {
     int i, j;
     for (j = 0; j < rows; ++j)
@@ -1475,18 +2670,6 @@ regress (void)
   }
 }
 
-static void
-no_sdl (int bits_per_pixel)
-{
-  grid = NULL;
-  grid8 = NULL;
-  if (32 == bits_per_pixel)
-    grid = (Uint32 *) allot (grid_size * sizeof grid[0]);
-  else if (8 == bits_per_pixel)
-    grid8 = (Uint8 *) allot (grid_size * sizeof grid8[0]);
-}
-
-
 /* Main program */
 
 /* Tusl word to run a read-eval-print loop. */
@@ -1511,10 +2694,19 @@ install_evo_words (ts_VM *vm)
       ts_install (vm, name, ts_do_push, (tsint) &toolbox[i].frequency);
     }
 
-  ts_install (vm, "thumb-width",     ts_do_push, thumb_width);
-  ts_install (vm, "thumb-height",    ts_do_push, thumb_height);
-  ts_install (vm, "cols",            ts_do_push, cols);
-  ts_install (vm, "rows",            ts_do_push, rows);
+  tile_cache_lock = SDL_CreateMutex ();
+  if (tile_cache_lock == NULL)
+    die ("Couldn't create the tile cache lock: %s", SDL_GetError ());
+  on_new_grid (lay_out);
+  ts_install (vm, "thumb-width",     do_push_value, (tsint) &thumb_width);
+  ts_install (vm, "thumb-height",    do_push_value, (tsint) &thumb_height);
+  ts_install (vm, "cols",            do_push_value, (tsint) &cols);
+  ts_install (vm, "rows",            do_push_value, (tsint) &rows);
+  ts_install (vm, "isaac-compat",    ts_do_push,    (tsint) &isaac_compat);
+  ts_install (vm, "fast-math",       ts_do_push,    (tsint) &fast_math);
+  ts_install (vm, "fused",           ts_do_push,    (tsint) &fused);
+  ts_install (vm, "tile-cache-limit", ts_do_push,   (tsint) &tile_cache_limit);
+  ts_install (vm, "flush-tile-cache", ts_run_void_0, (tsint) flush_tile_cache);
 
   ts_install (vm, "command-loop",    command_loop, 0);
 
@@ -1522,11 +2714,16 @@ install_evo_words (ts_VM *vm)
   ts_install (vm, "mutate",          ts_run_void_2, (tsint) sample);
   ts_install (vm, "copy",            ts_run_void_4, (tsint) copy);
   ts_install (vm, "generate",        ts_run_void_2, (tsint) generate);
+  ts_install (vm, "preview-all",     ts_run_void_0, (tsint) preview_all);
+  ts_install (vm, "generate-all",    ts_run_void_0, (tsint) generate_all);
   ts_install (vm, "generate-big",    ts_run_void_4, (tsint) generate_big);
   ts_install (vm, "complexity",      ts_run_int_2,  (tsint) complexity);
   ts_install (vm, "same-thumbs?",    ts_run_int_4,  (tsint) same_thumbs);
+  ts_install (vm, "same-genes?",     ts_run_int_4,  (tsint) same_genes);
 
   ts_install (vm, "save-image",      ts_run_void_0, (tsint) save_image);
+  ts_install (vm, "render-image",    ts_run_void_4, (tsint) render_image);
+  ts_install (vm, "render-genomes",  ts_run_void_4, (tsint) render_genomes_word);
   ts_install (vm, "append",          ts_run_void_0, (tsint) append);
   ts_install (vm, "append1",         ts_run_void_0, (tsint) append1);
   ts_install (vm, "save",            ts_run_void_0, (tsint) save);
@@ -1534,5 +2731,4 @@ install_evo_words (ts_VM *vm)
   ts_install (vm, "load-random",     ts_run_void_0, (tsint) load_random);
 
   ts_install (vm, "regress",         ts_run_void_0, (tsint) regress);
-  ts_install (vm, "no-sdl",          ts_run_void_1, (tsint) no_sdl);
 }
@@ -13,8 +13,10 @@
 :.mutate	coords mutate ;
 :.complexity	coords complexity ;
 :.same-thumbs? yz-  y coords  z coords  same-thumbs? ;
+:.same-genes? yz-  y coords  z coords  same-genes? ;
 :.copy yz-	y coords  z coords  copy ;
 :.generate-big yz-  y coords  z coords  generate-big ;
+:.render-image xyz-  x coords  y z render-image ;
 
 :.reshow	.generate show ;
 
@@ -26,6 +28,8 @@
 :reset		0 0 event 2! ;
 :absorb		event @ (unless)  wait event 2! ;
 
+\ An event that cuts a pass short stays in event, for react; so a
+\ second pass mustn't start then, or its poll would lose it.
 :gridding yz-	z thru? (unless)  poll (unless)  z y execute  y z 1+ gridding ;
 
 
@@ -34,16 +38,24 @@
 :minplexity (5 constant)
 :good-start?	.complexity minplexity > ;
 :initing z-	z .populate  z good-start? (unless)  z initing ;
-:init z-	z initing  z .reshow ;
-:fresh		'init 0 gridding ;
+\ A pass cut short has still replaced programs up to there, so show
+\ them (previewed, which is quick) before waiting on the event.
+:fresh		'initing 0 gridding  preview-all show
+		event @ (unless)  '.reshow 0 gridding ;
 
 :try z-		z 0 .copy  z .mutate ;
 :new? z-	z 0 .same-thumbs? 0= ;
-:decent? z-	0 .complexity 2 *  z .complexity 3 *  <
-		(if)  z .generate  show  z new? ;  (then)  false ;
+:complex? z-	0 .complexity 2 *  z .complexity 3 *  < ;
+\ Worth rendering: complex enough, and not the parent's graph over again.
+:viable? z-	z complex? (if)  z 0 .same-genes? 0= ;  (then)  false ;
+:decent? z-	z viable? (if)  z .generate  show  z new? ;  (then)  false ;
 :mutating z-	z try  z decent? (unless)  z mutating ;
-:replace z-	z mutating  show ;
-:choose z-	0 z .copy  0 .reshow  'replace 1 gridding ;
+:sowing z-	z try  z viable? (unless)  z sowing ;
+:replace z-	z .reshow  z new? (unless)  z mutating ;
+\ Mutate them all, preview them all at once, then render each in
+\ full, redoing any duplicates -- until the next click or keystroke.
+:choose z-	0 z .copy  'sowing 1 gridding  preview-all show
+		event @ (unless)  0 .reshow  'replace 1 gridding  show ;
 
 
 \ Gene frequencies
@@ -89,7 +101,7 @@
 :enlarging yz-	z thru? (unless)  y z zoom  poll (unless)  y z 1+ enlarging ;
 :big		0 0 enlarging ;
 
-:grid		'.reshow 0 gridding ;
+:grid		preview-all show  '.reshow 0 gridding ;
 
 :atomic-enlarging yz-
         	z thru? (unless)  y z .generate-big  y z 1+ atomic-enlarging ;
@@ -131,5 +143,7 @@
 \ (32 start-sdl restore grid reacting) \ for debugging
 
 :make-ppm z-	0 z .copy  atomic-big  save-image ;
+:make-print z-	z 4320 2880 .render-image ;
 \ (32 no-sdl restore 0 make-ppm  \ for batch image generation
+\ (32 no-sdl restore 0 make-print \ the same, at print size
 (32 start-sdl main)              \ for ordinary interactive runs
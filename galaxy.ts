@@ -0,0 +1,7 @@
+32 start-sdl
+
+ 100000000   0 0  0   0 make-particle
+    100000   1 120 scatter-particles
+
+:stepping  orbit-tree-tick show  listen-quit? (unless)  stepping ;
+(stepping report-frames)
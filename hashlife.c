@@ -0,0 +1,550 @@
+/*
+ Gosper's HashLife: Life on a quadtree of hash-consed nodes, where
+ each node remembers its own future. A pattern that repeats itself in
+ space or time costs little to run for a very long time, and jumps of
+ 2^k generations cost about the same as single steps.
+
+ The world is an unbounded plane, where the memoizing pays off: the
+ tree persists from jump to jump, and only the viewport shown is ever
+ flattened into cells.
+
+ Or, as a fallback that matches life-step cell for cell, it's the
+ same torus that life-step wraps around. A grid like 1024x768 doesn't
+ tile into power-of-2 squares, so there's no tree to keep: each jump
+ tiles the torus periodically out into a square big enough to hold its
+ light cone, runs that, and cuts the torus back out of the middle,
+ rebuilding from and flattening into the grid's cells every time --
+ O(grid) a hop, where a hop is at most half the grid's width in
+ generations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tusdl.h"
+
+enum {
+  max_jump    = 48,		/* log2 of the biggest jump we allow */
+  max_nodes   = 1 << 21		/* garbage-collect when we pass this */
+};
+
+typedef struct Node Node;
+struct Node {
+  int level;			/* A 2^level by 2^level square */
+  Node *nw, *ne, *sw, *se;	/* Quadrants, or NULL for a single cell */
+  double population;
+  Node *result;			/* The center half, 2^result_step
+				   generations later, or NULL */
+  int result_step;
+  unsigned hashcode;
+  Node *next;			/* The next node in the hashtable bucket */
+  int marked;
+};
+
+static Node dead_cell = { 0, NULL, NULL, NULL, NULL, 0 };
+static Node live_cell = { 0, NULL, NULL, NULL, NULL, 1 };
+
+/* The hashtable of all nodes above level 0. */
+static Node **buckets = NULL;
+static unsigned num_buckets = 0;
+static unsigned num_nodes = 0;
+
+/* empty[k] is the empty node of level k, when known. */
+static Node *empty_nodes[max_jump + 8];
+
+
+/* Node construction */
+
+/* Allocate `size' bytes or die. */
+static void *
+allot (size_t size)
+{
+  void *p = malloc (size);
+  if (p == NULL && size != 0)
+    die ("hashlife: out of memory");
+  return p;
+}
+
+static INLINE unsigned
+hash4 (Node *nw, Node *ne, Node *sw, Node *se)
+{
+  unsigned h = (unsigned) (size_t) nw;
+  h = h * 31 + (unsigned) (size_t) ne;
+  h = h * 31 + (unsigned) (size_t) sw;
+  h = h * 31 + (unsigned) (size_t) se;
+  return h ^ (h >> 15);
+}
+
+/* Double the hashtable, rehashing every node. */
+static void
+grow_table (void)
+{
+  unsigned n = num_buckets == 0 ? 1024 : 2 * num_buckets;
+  Node **b = allot (n * sizeof b[0]);
+  unsigned i;
+  memset (b, 0, n * sizeof b[0]);
+  for (i = 0; i < num_buckets; ++i)
+    {
+      Node *p, *q;
+      for (p = buckets[i]; p != NULL; p = q)
+	{
+	  q = p->next;
+	  p->next = b[p->hashcode & (n-1)];
+	  b[p->hashcode & (n-1)] = p;
+	}
+    }
+  free (buckets);
+  buckets = b;
+  num_buckets = n;
+}
+
+/* Return the unique node with the given quadrants. */
+static Node *
+join (Node *nw, Node *ne, Node *sw, Node *se)
+{
+  unsigned h = hash4 (nw, ne, sw, se);
+  Node *p;
+  if (num_buckets <= num_nodes)
+    grow_table ();
+  for (p = buckets[h & (num_buckets-1)]; p != NULL; p = p->next)
+    if (p->nw == nw && p->ne == ne && p->sw == sw && p->se == se)
+      return p;
+
+  p = allot (sizeof *p);
+  p->level = nw->level + 1;
+  p->nw = nw, p->ne = ne, p->sw = sw, p->se = se;
+  p->population =
+    nw->population + ne->population + sw->population + se->population;
+  p->result = NULL;
+  p->result_step = -1;
+  p->hashcode = h;
+  p->marked = 0;
+  p->next = buckets[h & (num_buckets-1)];
+  buckets[h & (num_buckets-1)] = p;
+  ++num_nodes;
+  return p;
+}
+
+static Node *
+empty (int level)
+{
+  if (empty_nodes[level] == NULL)
+    {
+      Node *e;
+      if (level == 0)
+	return &dead_cell;
+      e = empty (level - 1);
+      empty_nodes[level] = join (e, e, e, e);
+    }
+  return empty_nodes[level];
+}
+
+/* Return the center half of `node'. Pre: 2 <= node->level */
+static Node *
+center (Node *node)
+{
+  return join (node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+/* Return `node' surrounded by a border of empty space, one level up. */
+static Node *
+expand (Node *node)
+{
+  Node *e = empty (node->level - 1);
+  return join (join (e, e, e, node->nw), join (e, e, node->ne, e),
+	       join (e, node->sw, e, e), join (node->se, e, e, e));
+}
+
+
+/* Evolution */
+
+/* Return 1 iff the cell at (x,y) in the little node `node' is alive. */
+static int
+cell_at (Node *node, int x, int y)
+{
+  int half;
+  if (node->level == 0)
+    return node == &live_cell;
+  half = 1 << (node->level - 1);
+  if (y < half)
+    return x < half ? cell_at (node->nw, x, y) : cell_at (node->ne, x-half, y);
+  else
+    return x < half ? cell_at (node->sw, x, y-half)
+                    : cell_at (node->se, x-half, y-half);
+}
+
+/* Return the center 2x2 of a 4x4 node, one generation later. */
+static Node *
+life_4x4 (Node *node)
+{
+  Node *next[2][2];
+  int x, y;
+  for (y = 1; y <= 2; ++y)
+    for (x = 1; x <= 2; ++x)
+      {
+	int sum = 0, dx, dy;
+	for (dy = -1; dy <= 1; ++dy)
+	  for (dx = -1; dx <= 1; ++dx)
+	    if (dx != 0 || dy != 0)
+	      sum += cell_at (node, x + dx, y + dy);
+	next[y-1][x-1] =
+	  sum == 3 || (sum == 2 && cell_at (node, x, y)) ? &live_cell
+	                                                 : &dead_cell;
+      }
+  return join (next[0][0], next[0][1], next[1][0], next[1][1]);
+}
+
+/* Return the center half of `node', 2^step generations later.
+   Pre: 2 <= node->level, step <= node->level - 2 */
+static Node *
+successor (Node *node, int step)
+{
+  Node *c[9], *result;
+  Node *nw = node->nw, *ne = node->ne, *sw = node->sw, *se = node->se;
+  int i;
+
+  if (node->result != NULL && node->result_step == step)
+    return node->result;
+  if (node->population == 0)
+    return empty (node->level - 1);
+  if (node->level == 2)
+    {
+      node->result = life_4x4 (node);
+      node->result_step = 0;
+      return node->result;
+    }
+
+  /* Nine overlapping subsquares, each a quarter the size of `node'. */
+  c[0] = nw;
+  c[1] = join (nw->ne, ne->nw, nw->se, ne->sw);
+  c[2] = ne;
+  c[3] = join (nw->sw, nw->se, sw->nw, sw->ne);
+  c[4] = join (nw->se, ne->sw, sw->ne, se->nw);
+  c[5] = join (ne->sw, ne->se, se->nw, se->ne);
+  c[6] = sw;
+  c[7] = join (sw->ne, se->nw, sw->se, se->sw);
+  c[8] = se;
+
+  if (step == node->level - 2)
+    {
+      /* Two half-steps: advance the nine, then the four combinations. */
+      for (i = 0; i < 9; ++i)
+	c[i] = successor (c[i], step - 1);
+      result = join (successor (join (c[0], c[1], c[3], c[4]), step - 1),
+		     successor (join (c[1], c[2], c[4], c[5]), step - 1),
+		     successor (join (c[3], c[4], c[6], c[7]), step - 1),
+		     successor (join (c[4], c[5], c[7], c[8]), step - 1));
+    }
+  else
+    {
+      /* One full step on the nine, then just take their centers. */
+      for (i = 0; i < 9; ++i)
+	c[i] = successor (c[i], step);
+      result = join (join (c[0]->se, c[1]->sw, c[3]->ne, c[4]->nw),
+		     join (c[1]->se, c[2]->sw, c[4]->ne, c[5]->nw),
+		     join (c[3]->se, c[4]->sw, c[6]->ne, c[7]->nw),
+		     join (c[4]->se, c[5]->sw, c[7]->ne, c[8]->nw));
+    }
+  node->result = result;
+  node->result_step = step;
+  return result;
+}
+
+
+/* Garbage collection */
+
+static void
+mark (Node *node)
+{
+  if (node == NULL || node->level == 0 || node->marked)
+    return;
+  node->marked = 1;
+  mark (node->nw);
+  mark (node->ne);
+  mark (node->sw);
+  mark (node->se);
+}
+
+/* Free every node not reachable from `roots', and forget all results
+   (which might point to freed nodes). */
+static void
+collect (Node **roots, int num_roots)
+{
+  unsigned i;
+  int r;
+  for (r = 0; r < num_roots; ++r)
+    mark (roots[r]);
+  memset (empty_nodes, 0, sizeof empty_nodes);
+  for (i = 0; i < num_buckets; ++i)
+    {
+      Node **pp = &buckets[i];
+      while (*pp != NULL)
+	{
+	  Node *p = *pp;
+	  if (p->marked)
+	    {
+	      p->marked = 0;
+	      p->result = NULL;
+	      p->result_step = -1;
+	      pp = &p->next;
+	    }
+	  else
+	    {
+	      *pp = p->next;
+	      free (p);
+	      --num_nodes;
+	    }
+	}
+    }
+}
+
+
+/* Conversion to and from flat arrays */
+
+/* Set `bit' in each cell of the width x height array `out' (whose
+   top-left is at world coordinates (vx,vy)) that's alive in `node'
+   (whose top-left is at (nx,ny)). */
+static void
+rasterize (Node *node, long long nx, long long ny,
+	   Uint8 *out, int width, int height, long long vx, long long vy,
+	   Uint8 bit)
+{
+  long long size = 1LL << node->level;
+  if (node->population == 0)
+    return;
+  if (vx + width <= nx || vy + height <= ny || nx + size <= vx || ny + size <= vy)
+    return;
+  if (node->level == 0)
+    out[(ny - vy) * width + (nx - vx)] |= bit;
+  else
+    {
+      long long half = size / 2;
+      rasterize (node->nw, nx,        ny,        out, width, height, vx, vy, bit);
+      rasterize (node->ne, nx + half, ny,        out, width, height, vx, vy, bit);
+      rasterize (node->sw, nx,        ny + half, out, width, height, vx, vy, bit);
+      rasterize (node->se, nx + half, ny + half, out, width, height, vx, vy, bit);
+    }
+}
+
+static INLINE int
+wrap (long long v, int limit)
+{
+  int r = v % limit;
+  return r < 0 ? r + limit : r;
+}
+
+/* Return the node of the given level whose top-left is at (x0,y0) in
+   the width x height array of cells `in'. If `periodic', the array is
+   tiled across the plane; otherwise it's surrounded by dead cells. */
+static Node *
+build (int level, long long x0, long long y0,
+       const Uint8 *in, int width, int height, int periodic)
+{
+  if (level == 0)
+    {
+      if (periodic)
+	return in[wrap (y0, height) * width + wrap (x0, width)] & 1
+	  ? &live_cell : &dead_cell;
+      if (x0 < 0 || width <= x0 || y0 < 0 || height <= y0)
+	return &dead_cell;
+      return in[y0 * width + x0] & 1 ? &live_cell : &dead_cell;
+    }
+  if (!periodic
+      && (width <= x0 || height <= y0
+	  || x0 + (1LL << level) <= 0 || y0 + (1LL << level) <= 0))
+    return empty (level);
+  {
+    long long half = 1LL << (level - 1);
+    return join (build (level-1, x0,        y0,        in, width, height, periodic),
+		 build (level-1, x0 + half, y0,        in, width, height, periodic),
+		 build (level-1, x0,        y0 + half, in, width, height, periodic),
+		 build (level-1, x0 + half, y0 + half, in, width, height, periodic));
+  }
+}
+
+/* Return the least k such that max(grid_width, grid_height) <= 2^k. */
+static int
+grid_level (void)
+{
+  int k = 0;
+  while ((1 << k) < grid_width || (1 << k) < grid_height)
+    ++k;
+  return k;
+}
+
+
+/* The world */
+
+/* True for a torus the size of the grid, false for the unbounded plane. */
+static int torus = 0;
+
+/* On the torus: the alive cells now, and before the last jump. */
+static Uint8 *cells = NULL;
+static Uint8 *cells_before = NULL;
+
+/* On the plane: the world now, and before the last jump, with the
+   world coordinates of their top-left corners. */
+static Node *root = NULL, *root_before = NULL;
+static long long root_x, root_y, root_before_x, root_before_y;
+
+static double generation = 0;
+
+static void
+maybe_collect (void)
+{
+  if (max_nodes < num_nodes)
+    {
+      Node *roots[] = { root, root_before };
+      collect (roots, 2);
+    }
+}
+
+/* Advance the torus 2^step generations. */
+static void
+jump_torus (int step)
+{
+  int level = grid_level () + 1;
+  long long offset = 1LL << (level - 2);
+  int hop = step < level - 2 ? step : level - 2;
+  long long hops = 1LL << (step - hop);
+
+  memcpy (cells_before, cells, grid_size);
+  for (; 0 < hops; --hops)
+    {
+      Node *world = build (level, -offset, -offset,
+			   cells, grid_width, grid_height, 1);
+      Node *next = successor (world, hop);
+      memset (cells, 0, grid_size);
+      rasterize (next, 0, 0, cells, grid_width, grid_height, 0, 0, 1);
+      maybe_collect ();
+    }
+}
+
+/* Advance the plane 2^step generations. */
+static void
+jump_plane (int step)
+{
+  /* Grow the world until the pattern sits in its middle quarter,
+     far enough from the edges that it can't escape during the jump. */
+  while (root->level < step + 3
+	 || center (center (root))->population != root->population)
+    {
+      long long quarter = 1LL << (root->level - 1);
+      root = expand (root);
+      root_x -= quarter;
+      root_y -= quarter;
+    }
+  root_before = root;
+  root_before_x = root_x;
+  root_before_y = root_y;
+
+  {
+    long long quarter = 1LL << (root->level - 2);
+    root = successor (root, step);
+    root_x += quarter;
+    root_y += quarter;
+  }
+  maybe_collect ();
+}
+
+/* Forget the world when a new grid is made: it no longer fits. */
+static void
+forget_world (void)
+{
+  free (cells);
+  free (cells_before);
+  cells = cells_before = NULL;
+  root = root_before = NULL;
+}
+
+/* Advance the world 2^step generations. */
+static void
+hashlife_jump (int step)
+{
+  if (step < 0 || max_jump < step)
+    die ("hashlife-jump: step out of range: %d", step);
+  if (torus ? cells == NULL : root == NULL)
+    die ("hashlife-jump: nothing loaded");
+  if (torus)
+    jump_torus (step);
+  else
+    jump_plane (step);
+  generation += (double) (1LL << step);
+}
+
+/* Load the world from the alive cells of grid8. */
+static void
+hashlife_load (void)
+{
+  if (torus)
+    {
+      if (cells == NULL)
+	{
+	  cells        = allot (grid_size);
+	  cells_before = allot (grid_size);
+	}
+      memcpy (cells, grid8, grid_size);
+      memcpy (cells_before, grid8, grid_size);
+    }
+  else
+    {
+      root = build (grid_level (), 0, 0, grid8, grid_width, grid_height, 0);
+      root_before = root;
+      root_x = root_y = root_before_x = root_before_y = 0;
+    }
+  generation = 0;
+}
+
+/* Draw the world into grid8 as life-step would leave it (bit 0 alive
+   now, bit 1 alive before the last jump), with world coordinates
+   (x,y) at the top left. On the torus, the view wraps around. */
+static void
+hashlife_show (int x, int y)
+{
+  if (torus)
+    {
+      int i, j;
+      if (cells == NULL)
+	return;
+      for (j = 0; j < grid_height; ++j)
+	{
+	  int row = wrap (j + y, grid_height) * grid_width;
+	  for (i = 0; i < grid_width; ++i)
+	    {
+	      int k = row + wrap (i + x, grid_width);
+	      put8 (i, j, ((cells_before[k] & 1) << 1) | (cells[k] & 1));
+	    }
+	}
+    }
+  else
+    {
+      memset (grid8, 0, grid_size);
+      if (root == NULL)
+	return;
+      rasterize (root_before, root_before_x, root_before_y,
+		 grid8, grid_width, grid_height, x, y, 2);
+      rasterize (root, root_x, root_y,
+		 grid8, grid_width, grid_height, x, y, 1);
+    }
+}
+
+static void
+hashlife_report (void)
+{
+  printf ("generation %.0f, %u nodes", generation, num_nodes);
+  if (!torus && root != NULL)
+    printf (", population %.0f", root->population);
+  printf ("\n");
+}
+
+void
+install_hashlife_words (ts_VM *vm)
+{
+  on_new_grid (forget_world);
+  ts_install (vm, "hashlife-torus",  ts_do_push,    (tsint) &torus);
+  ts_install (vm, "hashlife-load",   ts_run_void_0, (tsint) hashlife_load);
+  ts_install (vm, "hashlife-jump",   ts_run_void_1, (tsint) hashlife_jump);
+  ts_install (vm, "hashlife-show",   ts_run_void_2, (tsint) hashlife_show);
+  ts_install (vm, ".hashlife",       ts_run_void_0, (tsint) hashlife_report);
+}
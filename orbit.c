@@ -1,6 +1,10 @@
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "sim.h"
+#include "workers.h"
 
 const double G  = 1.0e-6;
 const double dt = 0.001;
@@ -10,55 +14,16 @@ struct Particle {
   double m;			/* Mass */
   double rx, ry;		/* Position(t) */
   double vx, vy;		/* Velocity(t-dt/2) */
+  double ax, ay;		/* Acceleration(t) */
 };
 
-enum { max_particles = 1024 };
-
-static Particle particles[max_particles];
+static Particle *particles = NULL;
 static int num_particles = 0;
+static int max_particles = 0;	/* How many there's room for */
 
 
 /* SDL stuff */
 
-/* Boxes bounding changes to the grid since the last multishow() (inclusive). */
-static SDL_Rect bounds[max_particles];
-
-/* Redisplay the screen. */
-static void
-multishow (void)
-{
-  SDL_UpdateRects (screen, num_particles, bounds);
-  ++frame;
-}
-
-/* Plot a point on the screen-grid.  This assumes we get called twice
-   per frame for each index i, first with color==black to unplot the
-   old position, and then with some other color to plot the new
-   position. */
-static INLINE void
-put_point (unsigned gx, unsigned gy, Pixel color, int i)
-{
-  put (gx, gy, color);
-
-  if (color == black)
-    {
-      bounds[i].x = gx;
-      bounds[i].y = gy;
-    }
-  else
-    {
-      int w = gx - bounds[i].x;
-      int h = gy - bounds[i].y;
-      if (w < 0)
-	bounds[i].x += w, w = -w;
-      if (h < 0)
-	bounds[i].y += h, h = -h;
-
-      bounds[i].w = w + 1;
-      bounds[i].h = h + 1;
-    }
-}
-
 #define scale (1/3.0)
 
 /* Plot a particle on the screen. */
@@ -69,7 +34,7 @@ put_particle (int i, Pixel color)
   double y = particles[i].ry;
   unsigned gx = (unsigned) (grid_width * (scale * x + 0.5)) % grid_width;
   unsigned gy = (unsigned) (grid_height * (0.5 - scale * y)) % grid_height;
-  put_point (gx, gy, color, i);
+  put (gx, gy, color);
 }
 
 
@@ -88,52 +53,381 @@ compute_force (double *Fx, double *Fy, int i, int j)
   *Fy = F * y;
 }
 
-/* Update the state variables by one time-step. */
-static void 
-update_state (void)
+/* Set every particle's acceleration by summing the forces between
+   each pair directly. This is exact, and the reference for the tree
+   code below, but takes time quadratic in the number of particles. */
+static void
+direct_accelerations (void)
 {
   int i, j;
+  for (i = 0; i < num_particles; ++i)
+    particles[i].ax = particles[i].ay = 0;
   for (i = 0; i < num_particles; ++i)
     for (j = 0; j < i; ++j)
       {
 	double Fx, Fy;
 	compute_force (&Fx, &Fy, i, j);
-	particles[i].vx += Fx * (dt / particles[i].m);
-	particles[i].vy += Fy * (dt / particles[i].m);
-	particles[j].vx -= Fx * (dt / particles[j].m);
-	particles[j].vy -= Fy * (dt / particles[j].m);
+	particles[i].ax += Fx / particles[i].m;
+	particles[i].ay += Fy / particles[i].m;
+	particles[j].ax -= Fx / particles[j].m;
+	particles[j].ay -= Fy / particles[j].m;
       }
+}
+
+
+/* Barnes-Hut: the particles get sorted into a quadtree, and each one
+   is pulled by the far-off squares of the tree as if each were a
+   single body of their total mass at their center of mass. A square
+   counts as far off when its side over its distance is under theta. */
+
+/* theta, in hundredths. */
+static int opening_angle = 50;
+
+enum { leaf_size = 8, max_depth = 48, particles_per_job = 256 };
+
+typedef struct Node Node;
+struct Node {
+  double m, cx, cy;		/* Total mass and its center */
+  double x0, y0, side;		/* The square it covers */
+  int first, count;		/* Its particles are order[first..first+count-1] */
+  int children;			/* Its 4 children's first index, or 0 if a leaf */
+};
+
+static Node *nodes = NULL;
+static int num_nodes = 0;
+static int max_nodes = 0;
+
+static int *order = NULL;	/* Particle numbers, grouped by node */
+static int *scratch = NULL;	/* for partitioning order[] */
+
+static void *
+reallot (void *p, size_t size)
+{
+  p = realloc (p, size);
+  if (p == NULL)
+    die ("Out of memory for particles: %s", strerror (errno));
+  return p;
+}
+
+static int
+new_node (double x0, double y0, double side, int first, int count)
+{
+  Node *node;
+  if (max_nodes <= num_nodes)
+    {
+      max_nodes = max_nodes == 0 ? 1024 : 2 * max_nodes;
+      nodes = reallot (nodes, max_nodes * sizeof nodes[0]);
+    }
+  node = &nodes[num_nodes];
+  node->x0 = x0;
+  node->y0 = y0;
+  node->side = side;
+  node->first = first;
+  node->count = count;
+  node->children = 0;
+  return num_nodes++;
+}
+
+static INLINE int
+quadrant (const Node *node, const Particle *p)
+{
+  double half = node->side / 2;
+  return 2 * (node->y0 + half <= p->ry) + (node->x0 + half <= p->rx);
+}
+
+/* Fill in node #n's mass, splitting it into children first if it's
+   got too many particles to be a leaf. */
+static void
+build_node (int n, int depth)
+{
+  Node *node = &nodes[n];
+  int first = node->first, count = node->count;
+  double m = 0, mx = 0, my = 0;
+  int i, q;
+
+  if (count <= leaf_size || max_depth <= depth)
+    {
+      for (i = first; i < first + count; ++i)
+	{
+	  const Particle *p = &particles[order[i]];
+	  m  += p->m;
+	  mx += p->m * p->rx;
+	  my += p->m * p->ry;
+	}
+    }
+  else
+    {
+      int counts[4] = { 0, 0, 0, 0 }, starts[4];
+      double x0 = node->x0, y0 = node->y0, half = node->side / 2;
+      int children;
+
+      for (i = first; i < first + count; ++i)
+	++counts[quadrant (node, &particles[order[i]])];
+      starts[0] = first;
+      for (q = 1; q < 4; ++q)
+	starts[q] = starts[q-1] + counts[q-1];
+      for (i = first; i < first + count; ++i)
+	{
+	  int j = order[i];
+	  scratch[starts[quadrant (node, &particles[j])]++] = j;
+	}
+      memcpy (order + first, scratch + first, count * sizeof order[0]);
+
+      /* (new_node may move the nodes, so no more `node' from here.) */
+      children = num_nodes;
+      for (q = 0, i = first; q < 4; i += counts[q], ++q)
+	new_node (x0 + half * (q & 1), y0 + half * (q >> 1), half,
+		  i, counts[q]);
+      nodes[n].children = children;
+
+      for (q = 0; q < 4; ++q)
+	{
+	  const Node *child = &nodes[children + q];
+	  if (child->count == 0)
+	    continue;
+	  build_node (children + q, depth + 1);
+	  child = &nodes[children + q];
+	  m  += child->m;
+	  mx += child->m * child->cx;
+	  my += child->m * child->cy;
+	}
+    }
+
+  node = &nodes[n];
+  node->m = m;
+  node->cx = 0 < m ? mx / m : node->x0;
+  node->cy = 0 < m ? my / m : node->y0;
+}
+
+static void
+build_tree (void)
+{
+  double x0 = particles[0].rx, y0 = particles[0].ry, x1 = x0, y1 = y0;
+  int i;
+  for (i = 0; i < num_particles; ++i)
+    {
+      const Particle *p = &particles[i];
+      if (p->rx < x0) x0 = p->rx;
+      if (x1 < p->rx) x1 = p->rx;
+      if (p->ry < y0) y0 = p->ry;
+      if (y1 < p->ry) y1 = p->ry;
+      order[i] = i;
+    }
+  num_nodes = 0;
+  /* (A hair bigger, so the far edges fall inside too.) */
+  new_node (x0, y0, 1.0001 * (x1 - x0 < y1 - y0 ? y1 - y0 : x1 - x0),
+	    0, num_particles);
+  build_node (0, 0);
+}
+
+/* Return true iff p is outside the node's square. */
+static INLINE int
+outside (const Node *node, const Particle *p)
+{
+  return p->rx < node->x0 || node->x0 + node->side <= p->rx
+      || p->ry < node->y0 || node->y0 + node->side <= p->ry;
+}
+
+/* Set particle i's acceleration from the tree. */
+static void
+tree_acceleration (int i)
+{
+  Particle *p = &particles[i];
+  double theta = opening_angle / 100.0;
+  double ax = 0, ay = 0;
+  int stack[3 * max_depth + 4];
+  int top = 0;
+
+  stack[top++] = 0;
+  while (0 < top)
+    {
+      const Node *node = &nodes[stack[--top]];
+      double x = node->cx - p->rx;
+      double y = node->cy - p->ry;
+      double r2 = x*x + y*y;
+      if (node->count == 0)
+	continue;
+      if (node->side * node->side < theta * theta * r2 && outside (node, p))
+	{
+	  double a = G * node->m / (r2 * sqrt (r2));
+	  ax += a * x;
+	  ay += a * y;
+	}
+      else if (node->children == 0)
+	{
+	  int k;
+	  for (k = node->first; k < node->first + node->count; ++k)
+	    {
+	      const Particle *q = &particles[order[k]];
+	      if (q != p)
+		{
+		  double qx = q->rx - p->rx;
+		  double qy = q->ry - p->ry;
+		  double d2 = qx*qx + qy*qy;
+		  double a = G * q->m / (d2 * sqrt (d2));
+		  ax += a * qx;
+		  ay += a * qy;
+		}
+	    }
+	}
+      else
+	{
+	  stack[top++] = node->children + 0;
+	  stack[top++] = node->children + 1;
+	  stack[top++] = node->children + 2;
+	  stack[top++] = node->children + 3;
+	}
+    }
+  p->ax = ax;
+  p->ay = ay;
+}
+
+/* Job: set the accelerations of a run of particles, taken in tree
+   order so neighbors in space go together. */
+static void
+tree_job (void *data, int index, int worker)
+{
+  int k0 = index * particles_per_job;
+  int k1 = k0 + particles_per_job;
+  int k;
+  if (num_particles < k1)
+    k1 = num_particles;
+  for (k = k0; k < k1; ++k)
+    tree_acceleration (order[k]);
+}
 
+/* Set every particle's acceleration, approximately, in time about
+   n log n. */
+static void
+tree_accelerations (void)
+{
+  if (num_particles == 0)
+    return;
+  build_tree ();
+  run_jobs (tree_job, NULL,
+	    (num_particles + particles_per_job - 1) / particles_per_job);
+}
+
+
+/* Update the state variables by one time-step, with the accelerations
+   from `accelerate'. */
+static void
+update_state (void (*accelerate) (void))
+{
+  int i;
+  accelerate ();
   for (i = 0; i < num_particles; ++i)
     {
+      particles[i].vx += particles[i].ax * dt;
+      particles[i].vy += particles[i].ay * dt;
       particles[i].rx += particles[i].vx * dt;
       particles[i].ry += particles[i].vy * dt;
     }
 }
 
-/* Advance the simulation by one time-step. */
-static void 
-tick (void)
+static void
+step (void (*accelerate) (void))
 {
   int i;
   for (i = 0; i < num_particles; ++i)
     put_particle (i, black);
-  update_state ();
+  update_state (accelerate);
   for (i = 0; i < num_particles; ++i)
     put_particle (i, white);
 }
 
+/* Advance the simulation by one time-step, summing forces directly. */
 static void
-make_particle (int m, int rx, int ry, int vx, int vy)
+tick (void)
+{
+  step (direct_accelerations);
+}
+
+/* Advance the simulation by one time-step, with the tree code. */
+static void
+tree_tick (void)
 {
+  step (tree_accelerations);
+}
+
+/* Print how far the tree code's accelerations are from the exact
+   ones, relative to each exact one's size. */
+static void
+tree_error (void)
+{
+  double *tree_ax, *tree_ay, sum = 0, worst = 0;
+  int i;
+  if (num_particles == 0)
+    return;
+  tree_ax = reallot (NULL, num_particles * sizeof tree_ax[0]);
+  tree_ay = reallot (NULL, num_particles * sizeof tree_ay[0]);
+  tree_accelerations ();
+  for (i = 0; i < num_particles; ++i)
+    {
+      tree_ax[i] = particles[i].ax;
+      tree_ay[i] = particles[i].ay;
+    }
+  direct_accelerations ();
+  for (i = 0; i < num_particles; ++i)
+    {
+      double e = hypot (tree_ax[i] - particles[i].ax,
+			tree_ay[i] - particles[i].ay)
+	       / hypot (particles[i].ax, particles[i].ay);
+      sum += e * e;
+      if (worst < e)
+	worst = e;
+    }
+  printf ("Relative error: %g rms, %g worst\n",
+	  sqrt (sum / num_particles), worst);
+  free (tree_ax);
+  free (tree_ay);
+}
+
+static void
+add_particle (double m, double rx, double ry, double vx, double vy)
+{
+  Particle *p;
   if (max_particles <= num_particles)
-    die ("Too many particles");
-  particles[num_particles].m  = m/100.0;
-  particles[num_particles].rx = rx/100.0;
-  particles[num_particles].ry = ry/100.0;
-  particles[num_particles].vx = vx/100.0;
-  particles[num_particles].vy = vy/100.0;
-  ++num_particles;
+    {
+      max_particles = max_particles == 0 ? 1024 : 2 * max_particles;
+      particles = reallot (particles, max_particles * sizeof particles[0]);
+      order     = reallot (order,     max_particles * sizeof order[0]);
+      scratch   = reallot (scratch,   max_particles * sizeof scratch[0]);
+    }
+  p = &particles[num_particles++];
+  p->m  = m;
+  p->rx = rx;
+  p->ry = ry;
+  p->vx = vx;
+  p->vy = vy;
+  p->ax = p->ay = 0;
+}
+
+static void
+make_particle (int m, int rx, int ry, int vx, int vy)
+{
+  add_particle (m/100.0, rx/100.0, ry/100.0, vx/100.0, vy/100.0);
+}
+
+/* Add n particles of mass m/100, strewn evenly over a disk of radius
+   r/100 around the origin, each moving counterclockwise on a circular
+   orbit around the mass inside its own orbit. */
+static void
+scatter_particles (int n, int m, int r)
+{
+  double central = 0, radius = r/100.0;
+  int i;
+  for (i = 0; i < num_particles; ++i)
+    central += particles[i].m;
+  for (i = 0; i < n; ++i)
+    {
+      double d = radius * sqrt ((fast_rand () + 0.5) / 4294967296.0);
+      double angle = 2 * 3.14159265358979323846 * (fast_rand () / 4294967296.0);
+      double inside = central + n * (m/100.0) * (d * d) / (radius * radius);
+      double v = sqrt (G * inside / d);
+      add_particle (m/100.0, d * cos (angle), d * sin (angle),
+		    -v * sin (angle), v * cos (angle));
+    }
 }
 
 
@@ -143,6 +437,10 @@ void
 install_orbit_words (ts_VM *vm)
 {
   ts_install (vm, "make-particle",    ts_run_void_5, (tsint) make_particle);
-  ts_install (vm, "orbit-multishow",  ts_run_void_0, (tsint) multishow);
+  ts_install (vm, "scatter-particles", ts_run_void_3,
+	      (tsint) scatter_particles);
   ts_install (vm, "orbit-tick",       ts_run_void_0, (tsint) tick);
+  ts_install (vm, "orbit-tree-tick",  ts_run_void_0, (tsint) tree_tick);
+  ts_install (vm, "orbit-tree-error", ts_run_void_0, (tsint) tree_error);
+  ts_install (vm, "opening-angle",    ts_do_push,    (tsint) &opening_angle);
 }
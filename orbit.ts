@@ -4,5 +4,5 @@
        100  50 0  0 163 make-particle
 .s
 
-:stepping  orbit-tick orbit-multishow  listen-quit? (unless)  stepping ;
+:stepping  orbit-tick show  listen-quit? (unless)  stepping ;
 (stepping report-frames)
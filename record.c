@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tusdl.h"
+#include "record.h"
+
+/* A frame goes from the grid into one of two snapshot buffers (an
+   8-bit grid through its palette), and a writer thread turns it into
+   RGB bytes and writes them out. If the
+   writer is still behind with one snapshot when the next frame comes
+   along, that frame is dropped rather than make show() wait. */
+
+typedef enum { not_recording, to_pipe, to_files } Sink;
+
+static Sink sink = not_recording;
+static FILE *pipe_out = NULL;
+static char file_format[1024];	/* printf format for numbered files */
+
+/* Record only every record_every'th frame shown. */
+static int record_every = 1;
+
+static int frames_recorded, frames_dropped;
+
+static SDL_Thread *writer = NULL;
+
+/* Everything below is guarded by `lock'. */
+static SDL_mutex *lock = NULL;
+static SDL_cond *frame_posted;
+
+static Pixel *snapshots[2];
+static int snapshot_size = 0;	/* the grid_size they were allocated for */
+static int frame_width, frame_height; /* the grid's, as recording began */
+static int pending = -1;	/* snapshot waiting to be written, or -1 */
+static int writing = -1;	/* snapshot the writer has, or -1 */
+static int pending_number;	/* its frame number in the recording */
+static int stopping = 0;
+
+/* Write snapshot p as one frame, number n, and return true iff ok. */
+static int
+write_frame (const Pixel *p, int n)
+{
+  Uint8 *row = malloc (3 * frame_width);
+  FILE *out = pipe_out;
+  int ok = 1, x, y;
+  if (row == NULL)
+    return 0;
+  if (sink == to_files)
+    {
+      char filename[1100];
+      sprintf (filename, file_format, n);
+      out = fopen (filename, "wb");
+      if (out == NULL)
+	{
+	  fprintf (stderr, "%s: %s\n", filename, strerror (errno));
+	  free (row);
+	  return 0;
+	}
+      fprintf (out, "P6\n%d %d 255\n", frame_width, frame_height);
+    }
+  for (y = 0; ok && y < frame_height; ++y)
+    {
+      const Pixel *src = p + y * frame_width;
+      for (x = 0; x < frame_width; ++x)
+	{
+	  row[3*x+0] = 0xFF & (src[x] >> 16);
+	  row[3*x+1] = 0xFF & (src[x] >>  8);
+	  row[3*x+2] = 0xFF & (src[x] >>  0);
+	}
+      ok = 1 == fwrite (row, 3 * frame_width, 1, out);
+    }
+  if (sink == to_files && fclose (out) != 0)
+    ok = 0;
+  free (row);
+  return ok;
+}
+
+static int
+writer_main (void *arg)
+{
+  SDL_mutexP (lock);
+  for (;;)
+    {
+      int n, ok;
+      while (pending < 0 && !stopping)
+	SDL_CondWait (frame_posted, lock);
+      if (pending < 0)
+	break;
+      writing = pending;
+      n = pending_number;
+      pending = -1;
+      SDL_mutexV (lock);
+
+      ok = write_frame (snapshots[writing], n);
+
+      SDL_mutexP (lock);
+      writing = -1;
+      if (!ok)
+	{
+	  fprintf (stderr, "Error writing frame %d: %s\n", 
+		   n, strerror (errno));
+	  break;
+	}
+    }
+  SDL_mutexV (lock);
+  return 0;
+}
+
+static void
+stop_recording (void)
+{
+  if (sink == not_recording)
+    return;
+  SDL_mutexP (lock);
+  stopping = 1;
+  SDL_CondBroadcast (frame_posted);
+  SDL_mutexV (lock);
+  SDL_WaitThread (writer, NULL);
+  writer = NULL;
+
+  if (sink == to_pipe && pipe_out != NULL)
+    pclose (pipe_out);
+  pipe_out = NULL;
+  sink = not_recording;
+  printf ("%d frames recorded, %d dropped\n", frames_recorded, frames_dropped);
+}
+
+static void
+start_recording (Sink new_sink)
+{
+  int i;
+  if (grid == NULL && grid8 == NULL)
+    die ("There's no grid to record yet");
+  if (lock == NULL)
+    {
+      lock         = SDL_CreateMutex ();
+      frame_posted = SDL_CreateCond ();
+      if (lock == NULL || frame_posted == NULL)
+	die ("Couldn't create recorder locks: %s", SDL_GetError ());
+    }
+  if (snapshot_size != grid_size)
+    {
+      for (i = 0; i < 2; ++i)
+	{
+	  free (snapshots[i]);
+	  snapshots[i] = malloc (grid_size * sizeof snapshots[i][0]);
+	  if (snapshots[i] == NULL)
+	    die ("record: %s", strerror (errno));
+	}
+      snapshot_size = grid_size;
+    }
+  frame_width  = grid_width;
+  frame_height = grid_height;
+  pending = writing = -1;
+  stopping = 0;
+  frames_recorded = frames_dropped = 0;
+  sink = new_sink;
+  writer = SDL_CreateThread (writer_main, NULL);
+  if (writer == NULL)
+    die ("Couldn't create the recorder thread: %s", SDL_GetError ());
+}
+
+/* Start piping raw 24-bit RGB frames to the shell `command', e.g.
+   ffmpeg -f rawvideo -pix_fmt rgb24 -s 1024x768 -i - out.mp4 */
+static void
+record_to_pipe (const char *command)
+{
+  stop_recording ();
+  pipe_out = popen (command, "w");
+  if (pipe_out == NULL)
+    die ("%s: %s", command, strerror (errno));
+  start_recording (to_pipe);
+}
+
+/* Start writing frames as PPM files named by the printf `format',
+   numbered from 0, e.g. frame%05d.ppm */
+static void
+record_to_files (const char *format)
+{
+  stop_recording ();
+  if (sizeof file_format <= strlen (format))
+    die ("File name format too long");
+  strcpy (file_format, format);
+  start_recording (to_files);
+}
+
+/* Copy grid8 into `out' as RGB, in the colors it's showing now (the
+   palette may change from frame to frame). */
+static void
+snap8 (Pixel *out)
+{
+  Pixel rgb[256];
+  int i;
+  for (i = 0; i < 256; ++i)
+    rgb[i] = make_rgb (palette[i].r, palette[i].g, palette[i].b);
+  for (i = 0; i < frame_width * frame_height; ++i)
+    out[i] = rgb[grid8[i]];
+}
+
+void
+record_frame (void)
+{
+  int s;
+  if (sink == not_recording)
+    return;
+  if (1 < record_every && frame % record_every != 0)
+    return;
+
+  SDL_mutexP (lock);
+  if (0 <= pending || stopping)
+    {
+      ++frames_dropped;
+      SDL_mutexV (lock);
+      return;
+    }
+  s = writing == 0 ? 1 : 0;
+  SDL_mutexV (lock);
+
+  /* The writer won't touch snapshot s until we post it. */
+  if (grid != NULL)
+    memcpy (snapshots[s], grid, 
+	    frame_width * frame_height * sizeof grid[0]);
+  else
+    snap8 (snapshots[s]);
+
+  SDL_mutexP (lock);
+  pending = s;
+  pending_number = frames_recorded++;
+  SDL_CondBroadcast (frame_posted);
+  SDL_mutexV (lock);
+}
+
+void
+install_record_words (ts_VM *vm)
+{
+  atexit (stop_recording);
+  /* A new grid won't fit the snapshots, nor the frames already out. */
+  on_new_grid (stop_recording);
+  ts_install (vm, "record-to-pipe",  ts_run_void_1,   (tsint) record_to_pipe);
+  ts_install (vm, "record-to-files", ts_run_void_1,   (tsint) record_to_files);
+  ts_install (vm, "stop-recording",  ts_run_void_0,   (tsint) stop_recording);
+  ts_install (vm, "record-every",    ts_do_push,      (tsint) &record_every);
+}
@@ -0,0 +1,12 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+/* Recording the frames show() displays, to a pipe or to files. */
+
+/* Hand the grid to the recorder, if it's recording this frame. Only
+   copies it: the writing happens on a thread of its own. */
+void record_frame (void);
+
+void install_record_words (ts_VM *vm);
+
+#endif
@@ -4,8 +4,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "sim.h"
+#include "workers.h"
 
 /* Complain and terminate. */
 void
@@ -22,6 +24,21 @@ die (const char *message, ...)
   exit (1);
 }
 
+/* Batch mode: runtusdl --render genomes WIDTHxHEIGHT [format]
+   renders each evo genome in the file to its own PPM, on all cores. */
+static int
+render_main (int argc, char **argv)
+{
+  int width, height;
+  const char *format = 4 <= argc ? argv[3] : "render%04d.ppm";
+  if (argc < 3 || 4 < argc
+      || 2 != sscanf (argv[2], "%dx%d", &width, &height))
+    die ("Usage: runtusdl --render genomes WIDTHxHEIGHT [format]");
+  set_workers ((int) sysconf (_SC_NPROCESSORS_ONLN));
+  render_genomes (argv[1], width, height, format);
+  return 0;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -37,15 +54,19 @@ main (int argc, char **argv)
 
   ts_install (vm, "exit", ts_run_void_1, (tsint) exit);
   install_ants_words (vm);
+  install_bitlife_words (vm);
   install_casdl_words (vm);
   install_evo_words (vm);
+  install_hashlife_words (vm);
   install_orbit_words (vm);
   install_slime_words (vm);
   install_termite_words (vm);
   install_turtle_words (vm);
   install_wator_words (vm);
 
-  if (1 == argc)
+  if (2 <= argc && 0 == strcmp (argv[1], "--render"))
+    return render_main (argc - 1, argv + 1);
+  else if (1 == argc)
     ts_load_interactive (vm, stdin);
   else
     {
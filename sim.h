@@ -4,16 +4,85 @@
 #include "tusdl.h"
 #include "rand.h"
 
-extern randctx ctx;
+/* Random streams: a counter run through a keyed hash, so a stream is
+   just (key, counter) -- cheap to start anywhere, and any number of
+   them can be split off from one seed, e.g. one per thread or tile. */
+typedef struct Stream Stream;
+struct Stream {
+  unsigned key[2];
+  unsigned counter;
+};
+
+/* Start `stream' as stream number `id' of those keyed by `seed'. */
+void stream_init (Stream *stream, unsigned seed, unsigned id);
+
+/* Fill out[0..n-1] with the stream's next n numbers. */
+void stream_fill (Stream *stream, unsigned *out, int n);
+
+/* Fill out[0..n-1] with the stream's next n numbers in 0..bound-1,
+   without the bias of taking them % bound. Pre: 0 < bound */
+void stream_fill_below (Stream *stream, unsigned *out, int n, unsigned bound);
+
+/* (lowbias32, from Chris Wellons's hash prospector.) */
+static INLINE unsigned
+scramble (unsigned x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+/* The n'th number of `stream'. */
+static INLINE unsigned
+stream_at (const Stream *stream, unsigned n)
+{
+  return scramble (scramble (n + stream->key[0]) ^ stream->key[1]);
+}
+
+static INLINE unsigned
+stream_rand (Stream *stream)
+{
+  return stream_at (stream, stream->counter++);
+}
+
+/* The stream fast_rand() draws from in this thread: normally the one
+   seed_rand() starts, but each tile's own during a parallel pass. */
+extern __thread Stream *rand_stream;
 
 extern void seed_rand (int seed);
 
 static INLINE unsigned
 fast_rand (void)
 {
-  return RAND (&ctx);
+  return stream_rand (rand_stream);
 }
 
+/* Return a random number in 0..bound-1, unbiased, usually without
+   dividing (Lemire's method). Pre: 0 < bound */
+static INLINE unsigned
+fast_rand_below (unsigned bound)
+{
+  unsigned long long m = (unsigned long long) fast_rand () * bound;
+  if ((unsigned) m < bound)
+    {
+      unsigned threshold = -bound % bound;
+      while ((unsigned) m < threshold)
+	m = (unsigned long long) fast_rand () * bound;
+    }
+  return m >> 32;
+}
+
+/* Seed `r' the way fast_rand()'s ISAAC generator used to be seeded,
+   for callers that must reproduce its old sequences exactly. */
+void seed_isaac (randctx *r, int seed);
+
+/* Fill out[0..n-1] with the next n numbers RAND(r) would give, as
+   unsigned, a block of results at a time. */
+void isaac_fill (randctx *r, unsigned *out, int n);
+
 
 static INLINE int
 move (int z, int dz, int limit)
@@ -32,16 +101,24 @@ static const int dx[] = { 1, 1, 0, -1, -1, -1, 0, 1 };
 static const int dy[] = { 0, 1, 1, 1, 0, -1, -1, -1 };
 enum { east = 0, north = 2, west = 4, south = 6 };
 
+/* (A compare beats a % now that the grid size isn't a constant --
+   and unsigned % only wrapped -1 right for power-of-2 sizes anyway.) */
 static INLINE unsigned
 move_x (unsigned x, int direction)
 {
-  return (x + dx[direction]) % grid_width;
+  x += dx[direction];
+  if (x == (unsigned) grid_width) return 0;
+  if (x == (unsigned) -1)         return grid_width - 1;
+  return x;
 }
 
 static INLINE unsigned
 move_y (unsigned y, int direction)
 {
-  return (y + dy[direction]) % grid_height;
+  y += dy[direction];
+  if (y == (unsigned) grid_height) return 0;
+  if (y == (unsigned) -1)          return grid_height - 1;
+  return y;
 }
 
 static INLINE unsigned
@@ -62,16 +139,53 @@ scale_color (double value, double clamp)
 }
 
 
+/* Diffuse a whole grid's worth of stuff, on the torus: each patch
+   decays, then gives `fraction' of what's left to each of its 8
+   neighbors, all patches at once. The result goes into dest, which
+   mustn't be src; the rows are split across the workers. */
+void diffuse8_float (float *dest, const float *src, 
+		     float decay, float fraction);
+
+/* A sparse field: a whole-number amount of stuff at each patch, like
+   the ants' scent, that's mostly zero. The grid is cut into tiles,
+   and diffusing touches only the live ones -- those that may hold
+   some stuff -- and their neighbors, so it takes time in proportion
+   to the area the stuff covers rather than the grid's. */
+enum { field_tile_side = 32 };
+
+typedef struct Field Field;
+struct Field {
+  unsigned *value;		/* the amount at each patch */
+  unsigned *next;		/* scratch, for diffusing into */
+  Uint8 *live;			/* live[t] is true iff tile t may be nonzero */
+  Uint8 *busy;			/* scratch, for listing the work */
+  int *work;			/* ditto */
+  int tiles_across, tiles_down, num_tiles;
+};
+
+/* Size a field to a newly made grid, all zero. (Start it out zeroed,
+   e.g. as a static.) */
+void size_field (Field *field);
+
+void clear_field (Field *field);
+
+/* Add `amount' to the stuff at (x,y). Fine to call from an agent in
+   a parallel pass: any other thread marking the tile live does the
+   same. */
 static INLINE void
-diffuse8_float (float *array, unsigned x, unsigned y, double fraction)
+field_add (Field *field, unsigned x, unsigned y, unsigned amount)
 {
-  double droplet = array[at (x, y)] * fraction;
-  int i;
-  for (i = 0; i < 8; ++i)
-    array[move2 (x, y, i)] += droplet;
-  array[at (x, y)] -= 8 * droplet;
+  field->value[at (x, y)] += amount;
+  field->live[(y / field_tile_side) * field->tiles_across 
+	      + x / field_tile_side] = 1;
 }
 
+/* Diffuse like diffuse8_float, truncating the way the ants always
+   have: a patch keeps (value * keep) >> keep_shift of its value, and
+   gives that >> spread_shift to each neighbor. */
+void diffuse_field (Field *field, 
+		    unsigned keep, int keep_shift, int spread_shift);
+
 static INLINE unsigned
 pick_greater_double (double v0, unsigned u0, double v1, unsigned u1)
 {
@@ -126,52 +240,146 @@ follow_gradient_unsigned (unsigned *array,
 }
 
 
-int pick_empty_patch (int *array, int empty);
+/* Free `old' (if not NULL) and return a zeroed array of grid_size
+   elements of `size' bytes each -- for sizing a simulation's state
+   in its on_new_grid() hook. */
+void *reallot_grid (void *old, size_t size);
+
+/* An agent store keeps a simulation's agents as compact records, a
+   slot per agent rather than per cell: where each one is, and
+   whatever other fields the simulation adds, each an array of its
+   own. Maps from cells say who's where and what kind of agent it is.
+   Moving an agent just changes its cell; it keeps its slot and the
+   fields in it.
+
+   Dead agents are only marked dead, and swept out before the next pass
+   over the store, when the last agents move into their slots -- so
+   slots are stable during a pass, but not across them. */
+enum { max_agent_fields = 4 };
+
+typedef struct Agents Agents;
+struct Agents {
+  int count;			/* Agents 0..count-1, some maybe dead */
+  int capacity;
+  int *cell;			/* cell[a] is where agent a is, or -1 if dead */
+  int *occupant;		/* occupant[cell] is the agent there, or -1 */
+  Uint8 *kind;			/* kind[cell] is its kind, or 0 for none */
+  int *sorting;			/* scratch, for listing agents in order */
+  int num_fields;
+  struct {
+    void *array;		/* The address of the field's array */
+    size_t size;		/* of one element */
+  } fields[max_agent_fields];
+  SDL_mutex *lock;		/* Guards births during a parallel pass */
+  int in_parallel;
+};
 
-int list_patches (int *array, int value);
+/* Add a field to the agents' records: `array' is the address of a
+   pointer to its elements of `size' bytes, which the store allocates
+   and moves. Start the store out zeroed, e.g. as a static, and add all
+   its fields before adding any agents. */
+void add_agent_field (Agents *agents, void *array, size_t size);
 
-int find_neighbors4 (int *neighbors, int *array, int x, int y, int color);
+/* Fit the store to a newly made grid, with no agents. */
+void size_agents (Agents *agents);
 
+void clear_agents (Agents *agents);
+
+/* Add an agent of `kind' (nonzero) at the empty `cell', and return its
+   slot, for the caller to fill in its fields. */
+int add_agent (Agents *agents, int cell, int kind);
+
+static INLINE void
+kill_agent (Agents *agents, int a)
+{
+  int cell = agents->cell[a];
+  agents->occupant[cell] = -1;
+  agents->kind[cell] = 0;
+  agents->cell[a] = -1;
+}
+
+/* Move agent a to the empty `cell'. */
+static INLINE void
+move_agent (Agents *agents, int a, int cell)
+{
+  int from = agents->cell[a];
+  agents->kind[cell] = agents->kind[from];
+  agents->kind[from] = 0;
+  agents->occupant[from] = -1;
+  agents->occupant[cell] = a;
+  agents->cell[a] = cell;
+}
+
+/* Return the agent at `cell', or -1. */
+static INLINE int
+agent_at (const Agents *agents, int cell)
+{
+  return agents->occupant[cell];
+}
+
+/* Return the kind of agent at `cell', or 0 if there's none. */
+static INLINE int
+kind_at (const Agents *agents, int cell)
+{
+  return agents->kind[cell];
+}
+
+/* Return the kind of (live) agent a. */
+static INLINE int
+agent_kind (const Agents *agents, int a)
+{
+  return agents->kind[agents->cell[a]];
+}
+
+static INLINE void
+set_agent_kind (Agents *agents, int a, int kind)
+{
+  agents->kind[agents->cell[a]] = kind;
+}
+
+int find_agent_neighbors4 (int *neighbors, const Agents *agents, 
+			   int x, int y, int kind);
+
+/* Return a random one of the 4 cells beside (x,y) with an agent of
+   `kind' there (or none, for kind 0), or -1 if there's no such. */
 static INLINE int 
-pick_neighbor4 (int *array, int x, int y, int color)
+pick_agent_neighbor4 (const Agents *agents, int x, int y, int kind)
 {
   int neighbors[4];
-  int n_neighbors = find_neighbors4 (neighbors, array, x, y, color);
+  int n_neighbors = find_agent_neighbors4 (neighbors, agents, x, y, kind);
   if (0 < n_neighbors)
-    return neighbors[fast_rand () % n_neighbors];
+    return neighbors[fast_rand_below (n_neighbors)];
   else
     return -1;
 }
 
+/* Return a random cell with no agent in it and bare ground (0) under
+   it, where `ground' is a map of what's on the ground, or NULL. */
+int pick_vacant_cell (const Agents *agents, const Uint8 *ground);
+
+/* Paint the grid for show(): each cell gets agent_colors[kind] for
+   the kind of agent in it, or if there's none, ground_colors[] of
+   what's on the ground there (of 0, if ground is NULL). Only the
+   cells that change are marked dirty. */
+void render_agents (const Agents *agents, const Pixel *agent_colors,
+		    const Uint8 *ground, const Pixel *ground_colors);
+
+typedef void Agent_step (int agent, unsigned x, unsigned y);
+
+/* Call step on each agent of `kind' in order of their cells: first the
+   even-numbered ones in that order, then the odd. It's called on the
+   ones there were at the start, if they're still alive and of that
+   kind when their turn comes. */
+void for_all_agents (Agents *agents, int kind, Agent_step *step);
 
-#define FOR_ALL_PATCHES(proc)          \
-  do {                                 \
-    int x, y;                          \
-    for (y = 0; y < grid_height; ++y)  \
-      for (x = 0; x < grid_width; ++x) \
-	proc (at (x, y), x, y);        \
-  } while (0)
-
-/* Goddamn Windows seems to blow up this program whenever it has a
-   stack-allocated array that's too large.  So let's make it an extern
-   array instead: */
-extern int for_all_turtles_list[grid_size];
-
-#define FOR_ALL_TURTLES(array, value, proc)       \
-  {                                               \
-    int i;                                        \
-    int n = list_patches (array, value);          \
-    for (i = 0; i < n; i += 2)                    \
-      {                                           \
-	int j = for_all_turtles_list[i];          \
-	proc (j, j % grid_width, j / grid_width); \
-      }                                           \
-    for (i = 1; i < n; i += 2)                    \
-      {                                           \
-	int j = for_all_turtles_list[i];          \
-	proc (j, j % grid_width, j / grid_width); \
-      }                                           \
-  }
+/* Like for_all_agents, but spread across the worker threads. The
+   grid is cut into a checkerboard of tiles, and the tiles of one
+   color are run at once, each with its own random number stream
+   (split off from the caller's); so the outcome doesn't depend on the
+   number of threads, though it does differ from for_all_agents's.
+   `step' may only touch its own cell and the 8 around it, bear at most
+   one new agent, and only get random numbers from fast_rand(). */
+void for_all_agents_in_parallel (Agents *agents, int kind, Agent_step *step);
 
 
 #endif
@@ -4,48 +4,58 @@
 
 #include "sim.h"
 
-/* Cell state */
-static int occupied[grid_size];
-static unsigned heading[grid_size];
+/* The cells, each with a heading. */
+enum { cell_kind = 1 };
+static Agents cells;
+static unsigned *heading;
 
 /* Patch state */
-static float scent[grid_size];
+static float *scent = NULL;
+static float *scent_next = NULL; /* scent's next value, while diffusing */
+
+static void
+size_state (void)
+{
+  size_agents (&cells);
+  scent    = reallot_grid (scent,    sizeof scent[0]);
+  scent_next = reallot_grid (scent_next, sizeof scent_next[0]);
+}
 
 static void
 make_cell (int cell)
 {
-  occupied[cell] = 1;
-  heading[cell] = fast_rand () % 8;
+  int a = add_agent (&cells, cell, cell_kind);
+  heading[a] = fast_rand () % 8;
 }
 
 static void
-cell_move (int cell, unsigned x, unsigned y)
+cell_move (int a, unsigned x, unsigned y)
 {
+  int cell = at (x, y);
   scent[cell] += 1.0;
-  heading[cell] = 
-    ((1.5 < scent[cell] ? follow_gradient_float (scent, heading[cell], x, y) 
-                        : heading[cell])
+  heading[a] = 
+    ((1.5 < scent[cell] ? follow_gradient_float (scent, heading[a], x, y) 
+                        : heading[a])
      + (fast_rand () % 3) - 1) % 8;
   {
-    unsigned neighbor = move2 (x, y, heading[cell]);
-    if (occupied[neighbor])
-      heading[cell] = fast_rand () % 8;
+    unsigned neighbor = move2 (x, y, heading[a]);
+    if (0 <= agent_at (&cells, neighbor))
+      heading[a] = fast_rand () % 8;
     else
       {
 	if (0) scent[neighbor] = scent[cell]; /* interesting bug */
-	occupied[neighbor] = occupied[cell];
-	heading[neighbor]  = heading[cell];
-
-	occupied[cell]  = 0;
+	move_agent (&cells, a, neighbor);
       }
   }
 }
 
 static void
-update_patch (int cell, unsigned x, unsigned y)
+spread_scent (void)
 {
-  scent[cell] *= 0.95;
-  diffuse8_float (scent, x, y, 0.025);
+  float *t = scent;
+  diffuse8_float (scent_next, scent, 0.95, 0.025);
+  scent = scent_next;
+  scent_next = t;
 }
 
 static INLINE Uint8
@@ -59,7 +69,7 @@ color_scent (double scent)
 static INLINE Pixel
 patch_color (int patch)
 {
-  return make_rgb (occupied[patch] ? 255 : 0,
+  return make_rgb (0 <= agent_at (&cells, patch) ? 255 : 0,
 		   color_scent (scent[patch]),
 		   0);
 }
@@ -75,8 +85,16 @@ update_grid (void)
 static void
 tick (void)
 {
-  FOR_ALL_PATCHES (update_patch);
-  FOR_ALL_TURTLES (occupied, 1, cell_move);
+  spread_scent ();
+  for_all_agents (&cells, cell_kind, cell_move);
+  update_grid ();
+}
+
+static void
+parallel_tick (void)
+{
+  spread_scent ();
+  for_all_agents_in_parallel (&cells, cell_kind, cell_move);
   update_grid ();
 }
 
@@ -84,17 +102,19 @@ static void
 genesis (int population)
 {
   int i;
-  memset (occupied, 0, sizeof occupied);
-  memset (heading, 0, sizeof heading);
-  memset (scent, 0, sizeof scent);
+  clear_agents (&cells);
+  memset (scent, 0, grid_size * sizeof scent[0]);
   for (i = 0; i < population; ++i)
-    make_cell (pick_empty_patch (occupied, 0));
+    make_cell (pick_vacant_cell (&cells, NULL));
   update_grid ();
 }
 
 void
 install_slime_words (ts_VM *vm)
 {
+  add_agent_field (&cells, &heading, sizeof heading[0]);
+  on_new_grid (size_state);
   ts_install (vm, "slime-genesis", ts_run_void_1, (tsint) genesis);
   ts_install (vm, "slime-tick",    ts_run_void_0, (tsint) tick);
+  ts_install (vm, "slime-parallel-tick", ts_run_void_0, (tsint) parallel_tick);
 }
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "sim.h"
 
 enum {
@@ -8,23 +9,68 @@ enum {
   sand          = MAKE_RGB (192, 192, 0)
 };
 
-static unsigned heading[grid_size];
+/* The termites, each with a heading. */
+enum { emptyhanded_kind = 1, carrying_kind };
+static Agents termites;
+static unsigned *heading;
+
+/* What's on the ground in each cell. */
+enum { bare_ground, sand_ground };
+static Uint8 *ground;
+
+static const Pixel termite_colors[] = { empty, emptyhanded, carrying };
+static const Pixel ground_colors[]  = { empty, sand };
+
+/* Bring the grid up to date for show(). */
+static void
+render (void)
+{
+  render_agents (&termites, termite_colors, ground, ground_colors);
+}
+
+static void
+size_state (void)
+{
+  size_agents (&termites);
+  ground = reallot_grid (ground, sizeof ground[0]);
+  if (render_hook == render)
+    render_hook = NULL;
+}
 
 static void
 make_termite (int i)
 {
-  grid[i] = emptyhanded;
-  heading[i] = fast_rand () % 8;  
+  int a = add_agent (&termites, i, emptyhanded_kind);
+  heading[a] = fast_rand () % 8;  
 }
 
 static void
-genesis (int termites, int sands)
+genesis (int population, int sands)
 {
   int i;
+  clear_agents (&termites);
+  memset (ground, bare_ground, grid_size * sizeof ground[0]);
   for (i = 0; i < sands; ++i)
-    grid[pick_empty_patch (grid, empty)] = sand;
-  for (i = 0; i < termites; ++i)
-    make_termite (pick_empty_patch (grid, empty));
+    ground[pick_vacant_cell (&termites, ground)] = sand_ground;
+  for (i = 0; i < population; ++i)
+    make_termite (pick_vacant_cell (&termites, ground));
+  render_hook = render;
+}
+
+static INLINE int
+vacant (int cell)
+{
+  return kind_at (&termites, cell) == 0 && ground[cell] == bare_ground;
+}
+
+/* Return true iff there's sand in one of the 4 cells beside (x,y). */
+static INLINE int
+next_to_sand (int x, int y)
+{
+  return ground[at (move (x, -1, grid_width), y)] == sand_ground
+      || ground[at (x, move (y, -1, grid_height))] == sand_ground
+      || ground[at (move (x, 1, grid_width), y)] == sand_ground
+      || ground[at (x, move (y, 1, grid_height))] == sand_ground;
 }
 
 static void
@@ -33,18 +79,18 @@ emptyhanded_move (int termite, unsigned x, unsigned y)
   heading[termite] = (heading[termite] + fast_rand () % 3 - 1) % 8;
   {
     unsigned neighbor = move2 (x, y, heading[termite]);
-    if (grid[neighbor] == sand)
-      grid[termite] = carrying;
-    else if (grid[neighbor] != empty)
+    if (ground[neighbor] == sand_ground)
+      {
+	ground[neighbor] = bare_ground;
+	set_agent_kind (&termites, termite, carrying_kind);
+      }
+    else if (!vacant (neighbor))
       {
 	heading[termite] = fast_rand () % 8;
 	return;
       }
 
-    grid[neighbor]    = grid[termite];
-    heading[neighbor] = heading[termite];
-
-    grid[termite]     = empty;
+    move_agent (&termites, termite, neighbor);
   }  
 }
 
@@ -54,23 +100,18 @@ carrying_move (int termite, unsigned x, unsigned y)
   heading[termite] = (heading[termite] + fast_rand () % 3 - 1) % 8;
   {
     unsigned neighbor = move2 (x, y, heading[termite]);
-    if (grid[neighbor] != empty)
+    if (!vacant (neighbor))
       heading[termite] = fast_rand () % 8;
     else
       {
-	int neigh[4];
-	Pixel me = carrying, behind = empty;
-	if (0 < find_neighbors4 (neigh, grid, x, y, sand))
+	if (next_to_sand (x, y))
 	  {
-	    me = emptyhanded;
-	    behind = sand;
+	    set_agent_kind (&termites, termite, emptyhanded_kind);
+	    ground[at (x, y)] = sand_ground;
 	  }
 
-	grid[neighbor]    = me;
-	heading[neighbor] = heading[termite];
-
 	/* FIXME: this isn't necessarily adjacent to the sand */
-	grid[termite]     = behind;
+	move_agent (&termites, termite, neighbor);
       }
   }  
 }
@@ -78,13 +119,24 @@ carrying_move (int termite, unsigned x, unsigned y)
 static void
 tick (void)
 {
-  FOR_ALL_TURTLES (grid, emptyhanded, emptyhanded_move);
-  FOR_ALL_TURTLES (grid, carrying, carrying_move);
+  for_all_agents (&termites, emptyhanded_kind, emptyhanded_move);
+  for_all_agents (&termites, carrying_kind, carrying_move);
+}
+
+static void
+parallel_tick (void)
+{
+  for_all_agents_in_parallel (&termites, emptyhanded_kind, emptyhanded_move);
+  for_all_agents_in_parallel (&termites, carrying_kind, carrying_move);
 }
 
 void
 install_termite_words (ts_VM *vm)
 {
+  add_agent_field (&termites, &heading, sizeof heading[0]);
+  on_new_grid (size_state);
   ts_install (vm, "termite-genesis", ts_run_void_2, (tsint) genesis);
   ts_install (vm, "termite-tick",    ts_run_void_0, (tsint) tick);
+  ts_install (vm, "termite-parallel-tick",
+	      ts_run_void_0, (tsint) parallel_tick);
 }
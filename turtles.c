@@ -11,13 +11,14 @@ enum {
 
   tile_width      = 256,	/* in pixels */
   tile_height     = 256,
-  cols            = grid_width / tile_width,
-  rows            = grid_height / tile_height,
 
   max_turtles = 131072,
   max_nesting = 20
 };
 
+/* The screen's layout in tiles, set when the grid is made. */
+static int cols, rows;
+
 typedef struct Turtle Turtle;
 struct Turtle {
   float x, y;			/* Offset from the playfield's center. */
@@ -276,7 +277,18 @@ struct Instruc {
 };
 
 /* One genome for each tile on the screen: */
-static Instruc genome[rows*cols][genome_length];
+static Instruc (*genome)[genome_length] = NULL;
+
+static void
+lay_out (void)
+{
+  cols = grid_width / tile_width;
+  rows = grid_height / tile_height;
+  free (genome);
+  genome = calloc (rows*cols, sizeof genome[0]);
+  if (genome == NULL && 0 < rows*cols)
+    die ("Out of memory for genomes");
+}
 
 static void
 check_coord (int g)
@@ -410,8 +422,9 @@ install_turtle_words (ts_VM *vm)
 {
   ts_install (vm, "tile-width",     ts_do_push, tile_width);
   ts_install (vm, "tile-height",    ts_do_push, tile_height);
-  ts_install (vm, "tcols",          ts_do_push, cols);
-  ts_install (vm, "trows",          ts_do_push, rows);
+  on_new_grid (lay_out);
+  ts_install (vm, "tcols",          do_push_value, (tsint) &cols);
+  ts_install (vm, "trows",          do_push_value, (tsint) &rows);
 
   ts_install (vm, "plot", ts_run_void_0, (tsint) plot);
   ts_install (vm, "fd", ts_run_void_1, (tsint) fd);
@@ -1,25 +1,200 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <sys/time.h>
 
 #include "tusdl.h"
+#include "record.h"
+#include "workers.h"
 
 /* The screen and its grid of pixel values. */
 SDL_Surface *screen = NULL;
 Pixel *grid;
 Uint8 *grid8;
 
+SDL_Color palette[256];
+
+int grid_width  = 1024;
+int grid_height =  768;
+int grid_size   = 1024 * 768;
+
+/* The dimensions the next grid will have. */
+static int next_width  = 1024;
+static int next_height =  768;
+
+/* Set the dimensions for the next start-sdl or no-sdl. */
+static void
+set_grid_size (int width, int height)
+{
+  if (width <= 0 || height <= 0)
+    die ("Bad grid size: %d x %d", width, height);
+  next_width  = width;
+  next_height = height;
+}
+
+void
+set_colors (SDL_Color *colors, int first, int n)
+{
+  memcpy (palette + first, colors, n * sizeof palette[0]);
+  if (screen != NULL)
+    SDL_SetColors (screen, colors, first, n);
+}
+
+/* Dirty boxes. A box near one already marked gets merged into it,
+   since a few boxes a little too big redisplay faster than many
+   small ones; past max_dirty they all merge into one. */
+enum { 
+  max_dirty   = 64,
+  dirty_slack = 16		/* in pixels around a point put */
+};
+static Box dirty[max_dirty];
+static int num_dirty = 0;
+static Box no_box = { 0, 0, 0, 0 };
+Box *last_dirty = &no_box;
+
+/* Guards the dirty boxes, since workers mark the tiles they write. */
+static SDL_mutex *dirty_lock = NULL;
+
+/* Return true iff boxes a and b overlap or touch. */
+static int
+boxes_meet (const Box *a, const Box *b)
+{
+  return a->x0 <= b->x1 && b->x0 <= a->x1 
+      && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+/* Grow box a to cover b too. */
+static void
+box_union (Box *a, const Box *b)
+{
+  if (b->x0 < a->x0) a->x0 = b->x0;
+  if (b->y0 < a->y0) a->y0 = b->y0;
+  if (a->x1 < b->x1) a->x1 = b->x1;
+  if (a->y1 < b->y1) a->y1 = b->y1;
+}
+
+static void
+add_dirty (const Box *b)
+{
+  int i;
+  for (i = 0; i < num_dirty; ++i)
+    if (boxes_meet (&dirty[i], b))
+      break;
+  if (i == num_dirty && num_dirty == max_dirty)
+    {
+      for (i = 1; i < num_dirty; ++i)
+	box_union (&dirty[0], &dirty[i]);
+      num_dirty = 1;
+      i = 0;
+    }
+  if (i == num_dirty)
+    dirty[num_dirty++] = *b;
+  else
+    box_union (&dirty[i], b);
+  last_dirty = &dirty[i];
+}
+
+/* Mark the grid's width x height box at (x,y) as changed. */
+void
+mark_dirty (int x, int y, int width, int height)
+{
+  Box b;
+  b.x0 = x < 0 ? 0 : x;
+  b.y0 = y < 0 ? 0 : y;
+  b.x1 = grid_width  < x + width  ? grid_width  : x + width;
+  b.y1 = grid_height < y + height ? grid_height : y + height;
+  if (b.x1 <= b.x0 || b.y1 <= b.y0)
+    return;
+  if (dirty_lock != NULL)
+    SDL_mutexP (dirty_lock);
+  add_dirty (&b);
+  if (dirty_lock != NULL)
+    SDL_mutexV (dirty_lock);
+}
+
+/* Mark (x,y) and some slack around it as changed, so that puts to
+   nearby points find themselves already marked. */
+void
+mark_dirty_near (int x, int y)
+{
+  mark_dirty (x - dirty_slack, y - dirty_slack, 
+	      2 * dirty_slack + 1, 2 * dirty_slack + 1);
+}
+
+static void
+forget_dirty (void)
+{
+  num_dirty = 0;
+  last_dirty = &no_box;
+}
+
+/* Redisplay what's marked dirty, or all of it if nothing is. */
+static void
+update_screen (void)
+{
+  SDL_Rect rects[max_dirty];
+  int i;
+  if (num_dirty == 0)
+    {
+      SDL_UpdateRect (screen, 0, 0, 0, 0);
+      return;
+    }
+  for (i = 0; i < num_dirty; ++i)
+    {
+      rects[i].x = dirty[i].x0;
+      rects[i].y = dirty[i].y0;
+      rects[i].w = dirty[i].x1 - dirty[i].x0;
+      rects[i].h = dirty[i].y1 - dirty[i].y0;
+    }
+  SDL_UpdateRects (screen, num_dirty, rects);
+}
+
+enum { max_grid_hooks = 32 };
+static void (*grid_hooks[max_grid_hooks]) (void);
+static int num_grid_hooks = 0;
+
+void
+on_new_grid (void (*hook) (void))
+{
+  if (max_grid_hooks <= num_grid_hooks)
+    die ("Too many new-grid hooks");
+  grid_hooks[num_grid_hooks++] = hook;
+}
+
+/* Fix the grid's dimensions at the requested size, and let every
+   module know. */
+static void
+size_grid (void)
+{
+  int i;
+  grid_width  = next_width;
+  grid_height = next_height;
+  grid_size   = grid_width * grid_height;
+  forget_dirty ();
+  for (i = 0; i < num_grid_hooks; ++i)
+    grid_hooks[i] ();
+}
+
+void
+do_push_value (ts_VM *vm, ts_Word *pw)
+{
+  ts_INPUT_0 (vm);
+  ts_OUTPUT_1 (*(int *) pw->datum);
+}
+
 /* Clear the screen grid. */
 static void
 clear (void)
 {
   memset (grid, 0, grid_width * grid_height * sizeof grid[0]);
+  mark_dirty (0, 0, grid_width, grid_height);
 }
 
 static void
 clear8 (void)
 {
   memset (grid8, 0, grid_width * grid_height * sizeof grid8[0]);
+  mark_dirty (0, 0, grid_width, grid_height);
 }
 
 static void
@@ -44,12 +219,59 @@ event_adapter (ts_VM *vm, SDL_Event *eventp)
   ts_OUTPUT_2 (0, 0);
 }
 
+/* Without a window there are no real events, only the ones a script
+   posts ahead of time, in the same (value, type) form as above. */
+enum { max_posted_events = 256 };
+static struct { int value, type; } posted[max_posted_events];
+static int posted_head = 0, posted_count = 0;
+
+int frame;
+
+/* If nonzero, a headless run sees a 'q' keypress once it's shown this
+   many frames, so demos that loop until 'q' can run unattended. */
+static int quit_frame = 0;
+
+static void
+post_event (int value, int type)
+{
+  int i = (posted_head + posted_count) % max_posted_events;
+  if (max_posted_events <= posted_count)
+    die ("Too many posted events");
+  posted[i].value = value;
+  posted[i].type  = type;
+  ++posted_count;
+}
+
+/* Push the next posted event's info on the stack, or else a quit if
+   `blocking' (there's nothing else to wait for) or the frame limit is
+   up, or else no event. */
+static void
+posted_event (ts_VM *vm, int blocking)
+{
+  ts_INPUT_0 (vm);
+  if (0 < posted_count)
+    {
+      int value = posted[posted_head].value;
+      int type  = posted[posted_head].type;
+      posted_head = (posted_head + 1) % max_posted_events;
+      --posted_count;
+      ts_OUTPUT_2 (value, type);
+    }
+  else if (blocking || (0 < quit_frame && quit_frame <= frame))
+    ts_OUTPUT_2 ('q', 1);
+  else
+    ts_OUTPUT_2 (0, 0);
+}
+
 /* Poll for an SDL event and push its info on the stack. */
 static void
 listen (ts_VM *vm, ts_Word *pw)
 {
   SDL_Event event;
-  event_adapter (vm, SDL_PollEvent (&event) ? &event : NULL);
+  if (screen == NULL)
+    posted_event (vm, 0);
+  else
+    event_adapter (vm, SDL_PollEvent (&event) ? &event : NULL);
 }
 
 /* Wait for an SDL event and push its info on the stack. */
@@ -57,26 +279,47 @@ static void
 blocking_listen (ts_VM *vm, ts_Word *pw)
 {
   SDL_Event event;
-  SDL_WaitEvent (&event);
-  event_adapter (vm, &event);
+  if (screen == NULL)
+    posted_event (vm, 1);
+  else
+    {
+      SDL_WaitEvent (&event);
+      event_adapter (vm, &event);
+    }
 }
 
-int frame;
+void (*render_hook) (void) = NULL;
 
-/* Redisplay the screen. */
+/* Redisplay what's changed on the screen -- or, headless, just count
+   the frame. */
 static void
 show (void)
 {
-  SDL_UpdateRect (screen, 0, 0, 0, 0);
+  if (render_hook != NULL)
+    render_hook ();
+  record_frame ();
+  if (screen != NULL)
+    update_screen ();
+  forget_dirty ();
   ++frame;
 }
 
+/* Return the wall-clock time in seconds. (Not clock(), which adds up
+   the CPU time of all our threads.) */
+static double
+wall_time (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double starting_time;
+
 static void
 report_frames (ts_VM *vm, ts_Word *pw)
 {
-  clock_t end = clock ();
-  clock_t start = (clock_t) vm->words[ts_lookup (vm, "starting-clocks")].datum;
-  double seconds = (end - start) / (double)CLOCKS_PER_SEC;
+  double seconds = wall_time () - starting_time;
   printf ("%d frames\n", frame);
   printf ("%.3g per second\n", frame / seconds);
   printf ("%.3g megapixels/second\n", 
@@ -84,13 +327,24 @@ report_frames (ts_VM *vm, ts_Word *pw)
 }
 
 
+/* Nonzero to make start-sdl act like no-sdl, so a demo can run on a
+   machine without a display. Starts out set if TUSDL_HEADLESS is in
+   the environment. */
+static int headless = 0;
+
 void
 start_sdl (int bits_per_pixel)
 {
+  if (headless)
+    {
+      no_sdl (bits_per_pixel);
+      return;
+    }
   if (SDL_Init (SDL_INIT_VIDEO) < 0)
     die ("No init possible: %s\n", SDL_GetError ());
   atexit (SDL_Quit);
 
+  size_grid ();
   screen = SDL_SetVideoMode (grid_width, grid_height, bits_per_pixel, 
 			     SDL_SWSURFACE | SDL_HWPALETTE);
   if (screen == NULL)
@@ -104,10 +358,55 @@ start_sdl (int bits_per_pixel)
     grid8 = (Uint8 *) screen->pixels;
 }
 
+/* The grid's memory when there's no window, aligned to a cache line
+   so rows of tiles start on one. */
+enum { pixel_alignment = 64 };
+static void *pixel_memory = NULL;
+
+static void *
+allot_pixels (size_t size)
+{
+  size_t p;
+  free (pixel_memory);
+  pixel_memory = malloc (size + pixel_alignment - 1);
+  if (pixel_memory == NULL)
+    die ("no-sdl: %s", strerror (errno));
+  p = ((size_t) pixel_memory + pixel_alignment - 1) 
+      & ~(size_t) (pixel_alignment - 1);
+  return (void *) p;
+}
+
+/* Like start_sdl, but with the grid in plain memory and no window. */
+void
+no_sdl (int bits_per_pixel)
+{
+  size_grid ();
+  screen = NULL;
+  grid = NULL;
+  grid8 = NULL;
+  if (32 == bits_per_pixel)
+    grid = (Uint32 *) allot_pixels (grid_size * sizeof grid[0]);
+  else if (8 == bits_per_pixel)
+    grid8 = (Uint8 *) allot_pixels (grid_size * sizeof grid8[0]);
+}
+
 static void
 install_sdl_words (ts_VM *vm)
 {
+  int i;
+  for (i = 0; i < 256; ++i)
+    palette[i].r = palette[i].g = palette[i].b = i;
+
+  dirty_lock = SDL_CreateMutex ();
+  if (dirty_lock == NULL)
+    die ("Couldn't create the dirty-box lock: %s", SDL_GetError ());
+
+  ts_install (vm, "grid-size!",      ts_run_void_2,   (tsint) set_grid_size);
   ts_install (vm, "start-sdl",       ts_run_void_1,   (tsint) start_sdl);
+  ts_install (vm, "no-sdl",          ts_run_void_1,   (tsint) no_sdl);
+  ts_install (vm, "headless",        ts_do_push,      (tsint) &headless);
+  ts_install (vm, "quit-frame",      ts_do_push,      (tsint) &quit_frame);
+  ts_install (vm, "post-event",      ts_run_void_2,   (tsint) post_event);
 
   ts_install (vm, "listen",          listen,          0);
   ts_install (vm, "wait",            blocking_listen, 0);
@@ -121,8 +420,8 @@ install_sdl_words (ts_VM *vm)
 
   ts_install (vm, "frames",          ts_do_push,      (tsint) &frame);
 
-  ts_install (vm, "width",           ts_do_push,      grid_width);
-  ts_install (vm, "height",          ts_do_push,      grid_height);
+  ts_install (vm, "width",           do_push_value,   (tsint) &grid_width);
+  ts_install (vm, "height",          do_push_value,   (tsint) &grid_height);
 
   ts_install (vm, "red",             ts_do_push,      red);
   ts_install (vm, "green",           ts_do_push,      green);
@@ -130,7 +429,10 @@ install_sdl_words (ts_VM *vm)
 
   ts_load (vm, "sim.ts");
 
-  ts_install (vm, "starting-clocks", ts_do_push,      (tsint) clock ());
+  ts_install (vm, "set-workers",     ts_run_void_1,   (tsint) set_workers);
+  install_record_words (vm);
+
+  starting_time = wall_time ();
   ts_install (vm, "report-frames",   report_frames,   0);
 }
 
@@ -138,6 +440,7 @@ ts_VM *
 make_sdl_vm (void)
 {
   ts_VM *vm = ts_vm_make ();
+  headless = getenv ("TUSDL_HEADLESS") != NULL;
   ts_install_standard_words (vm);
   ts_install_unsafe_words (vm);
   install_sdl_words (vm);
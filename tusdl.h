@@ -4,25 +4,14 @@
 #include "SDL.h"
 #include <tusl.h>
 
-enum { 
-#if 0
-  grid_width  = 2048,
-  grid_height = 2048,
-#elif 0
-  grid_width  = 2400,
-  grid_height = 1600,
-#elif 0
-  grid_width  = 4320,
-  grid_height = 2880,
-#elif 0
-  grid_width  = 1200,
-  grid_height =  800,
-#else
-  grid_width  = 1024,
-  grid_height =  768,
-#endif
-  grid_size   = grid_width * grid_height
-};
+/* The grid's dimensions. These are fixed when start-sdl (or no-sdl)
+   makes the grid, from the last grid-size! -- 1024x768 by default.
+   Some handy sizes: 2048x2048, 2400x1600, 4320x2880, 1200x800. */
+extern int grid_width, grid_height, grid_size;
+
+/* Have `hook' called each time a new grid is made, once its dimensions
+   are set, so a module can size its own arrays to match. */
+void on_new_grid (void (*hook) (void));
 
 typedef Uint32 Pixel;
 
@@ -32,6 +21,10 @@ void die (const char *message, ...);
 
 extern int frame;
 
+/* If set, show() calls this first, to bring the screen grid up to
+   date from a simulation's own representation of its state. */
+extern void (*render_hook) (void);
+
 extern SDL_Surface *screen;
 extern Pixel *grid;
 extern Uint8 *grid8;
@@ -42,11 +35,38 @@ at (int x, int y)
   return y * grid_width + x;
 }
 
+/* The parts of the grid changed since the last show(), as a few
+   boxes, so show() can redisplay just those. put() and put8() keep
+   track themselves (on the main thread only); code that writes into
+   the grid some other way should call mark_dirty() for what it
+   changes -- from any thread -- or else mark nothing that frame, which
+   show() takes to mean the whole grid changed. */
+typedef struct Box Box;
+struct Box {
+  int x0, y0, x1, y1;		/* x1 and y1 are just past the edge */
+};
+
+/* The box marked last, to check quickly whether a point's in it. */
+extern Box *last_dirty;
+
+void mark_dirty (int x, int y, int width, int height);
+void mark_dirty_near (int x, int y);
+
+/* Mark (x,y) as changed. */
+static INLINE void
+note_dirty (int x, int y)
+{
+  if (x < last_dirty->x0 || last_dirty->x1 <= x 
+      || y < last_dirty->y0 || last_dirty->y1 <= y)
+    mark_dirty_near (x, y);
+}
+
 /* Set the grid location (x,y) to `color'. */
 static INLINE void
 put (int x, int y, Pixel color)
 {
   grid[at (x, y)] = color;
+  note_dirty (x, y);
 }
 
 static INLINE Pixel
@@ -60,6 +80,7 @@ static INLINE void
 put8 (int x, int y, Uint8 color)
 {
   grid8[at (x, y)] = color;
+  note_dirty (x, y);
 }
 
 static INLINE Pixel
@@ -68,6 +89,14 @@ get8 (int x, int y)
   return grid8[at (x, y)];
 }
 
+/* The 8-bpp grid's colors, as set_colors() last left them -- a grey
+   ramp to start. Kept even without a window, for recording. */
+extern SDL_Color palette[256];
+
+/* Set palette[first..first+n-1] to colors[0..n-1], on the screen too
+   if there is one. */
+void set_colors (SDL_Color *colors, int first, int n);
+
 
 /* We need the macro so we can use it in constant expressions. */
 #define MAKE_RGB(r, g, b) (((r) << 16) + ((g) << 8) + (b))
@@ -91,15 +120,27 @@ enum {
 ts_VM *make_sdl_vm (void);
 
 void start_sdl (int bits_per_pixel);
+void no_sdl (int bits_per_pixel);
+
+/* Tusl action to push the int that pw->datum points to -- for a
+   constant that's only known once the grid has been made. */
+void do_push_value (ts_VM *vm, ts_Word *pw);
 
 void install_ants_words (ts_VM *vm);
+void install_bitlife_words (ts_VM *vm);
 void install_casdl_words (ts_VM *vm);
 void install_evo_words (ts_VM *vm);
+void install_hashlife_words (ts_VM *vm);
 void install_orbit_words (ts_VM *vm);
 void install_slime_words (ts_VM *vm);
 void install_termite_words (ts_VM *vm);
 void install_turtle_words (ts_VM *vm);
 void install_wator_words (ts_VM *vm);
 
+/* Render each genome in an evo-saved style file to its own PPM file,
+   named by a printf format and its index; return how many. */
+int render_genomes (const char *genomes, int width, int height, 
+		    const char *format);
+
 
 #endif
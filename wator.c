@@ -4,7 +4,6 @@
 #include "sim.h"
 
 enum {
-  max_critters = grid_size,
   empty        = black,
   fish_color   = green,
   shark_color  = red
@@ -15,98 +14,119 @@ static int
   shark_breeding_age,
   shark_starve_time;
 
-static short health[max_critters];
-static short breeding_countdown[max_critters];
+/* The critters, with these fields. */
+enum { fish_kind = 1, shark_kind };
+static Agents critters;
+static short *health;
+static short *breeding_countdown;
 
+static const Pixel critter_colors[] = { empty, fish_color, shark_color };
+
+/* Bring the grid up to date for show(). */
 static void
-make_fish (int i)
+render (void)
 {
-  breeding_countdown[i] = fast_rand () % fish_breeding_age;
-
-  grid[i] = fish_color;
+  render_agents (&critters, critter_colors, NULL, critter_colors);
 }
 
 static void
-make_shark (int i)
+size_state (void)
 {
-  health[i] = fast_rand () % shark_starve_time;
-  breeding_countdown[i] = fast_rand () % shark_breeding_age;
+  size_agents (&critters);
+  if (render_hook == render)
+    render_hook = NULL;
+}
 
-  grid[i] = shark_color;
+/* Set field[first..first+n-1] to random numbers in 0..bound-1, drawn
+   a block at a time. */
+static void
+draw_below (short *field, int first, int n, int bound)
+{
+  unsigned draws[1024];
+  while (0 < n)
+    {
+      int i, k = n < 1024 ? n : 1024;
+      stream_fill_below (rand_stream, draws, k, bound);
+      for (i = 0; i < k; ++i)
+	field[first + i] = draws[i];
+      first += k;
+      n -= k;
+    }
 }
 
 static void
 genesis (int initial_fish_population, int initial_shark_population)
 {
-  int i;
-  memset (health, 0, sizeof health);
-  memset (breeding_countdown, 0, sizeof breeding_countdown);
-  for (i = 0; i < initial_fish_population; ++i)
-    make_fish (pick_empty_patch (grid, empty));
-  for (i = 0; i < initial_shark_population; ++i)
-    make_shark (pick_empty_patch (grid, empty));
+  int i, fish = initial_fish_population, sharks = initial_shark_population;
+  clear_agents (&critters);
+  for (i = 0; i < fish; ++i)
+    add_agent (&critters, pick_vacant_cell (&critters, NULL), fish_kind);
+  for (i = 0; i < sharks; ++i)
+    add_agent (&critters, pick_vacant_cell (&critters, NULL), shark_kind);
+  /* The fish are agents 0..fish-1 and the sharks the rest; give them
+     their starting ages a field at a time. */
+  draw_below (breeding_countdown, 0, fish, fish_breeding_age);
+  draw_below (health, fish, sharks, shark_starve_time);
+  draw_below (breeding_countdown, fish, sharks, shark_breeding_age);
+  render_hook = render;
 }
 
 static INLINE void
-bear_fish (int baby)
+bear_fish (int cell)
 {
+  int baby = add_agent (&critters, cell, fish_kind);
   breeding_countdown[baby] = fish_breeding_age - fast_rand () % 5;
 }
 
 static INLINE void
-bear_shark (int baby)
+bear_shark (int cell)
 {
+  int baby = add_agent (&critters, cell, shark_kind);
   health[baby] = shark_starve_time;
   breeding_countdown[baby] = shark_breeding_age - fast_rand () % 5;
 }
 
 static void
-move_fish (int fish, int x, int y)
+move_fish (int fish, unsigned x, unsigned y)
 {
   int countdown = --breeding_countdown[fish];
-  int neighbor = pick_neighbor4 (grid, x, y, empty);
+  int neighbor = pick_agent_neighbor4 (&critters, x, y, 0);
   if (-1 != neighbor)
     {
-      grid[neighbor] = fish_color;
-      breeding_countdown[neighbor] = countdown;
-      
-      if (0 < countdown)
-	grid[fish] = empty;
-      else 
+      move_agent (&critters, fish, neighbor);
+      if (countdown <= 0)
 	{
-	  bear_fish (fish);
-	  breeding_countdown[neighbor] = fish_breeding_age;
+	  bear_fish (at (x, y));
+	  breeding_countdown[fish] = fish_breeding_age;
 	}
     }
 }
 
 static void
-move_shark (int shark, int x, int y)
+move_shark (int shark, unsigned x, unsigned y)
 {
   if (--health[shark] < 0)
-    grid[shark] = empty;
+    kill_agent (&critters, shark);
   else
     {
       int countdown = --breeding_countdown[shark];
-      int neighbor = pick_neighbor4 (grid, x, y, fish_color);
+      int neighbor = pick_agent_neighbor4 (&critters, x, y, fish_kind);
       if (-1 != neighbor)
-	health[shark] = shark_starve_time; /* neighbor is a fish -- eat it */
+	{
+	  /* neighbor is a fish -- eat it */
+	  health[shark] = shark_starve_time;
+	  kill_agent (&critters, agent_at (&critters, neighbor));
+	}
       else
-	neighbor = pick_neighbor4 (grid, x, y, empty);
+	neighbor = pick_agent_neighbor4 (&critters, x, y, 0);
 
       if (-1 != neighbor)
 	{      
-	  grid[neighbor] = shark_color;
-	  health[neighbor] = health[shark];
-	  if (0 < countdown)
-	    {
-	      grid[shark] = empty;
-	      breeding_countdown[neighbor] = breeding_countdown[shark];
-	    }
-	  else
+	  move_agent (&critters, shark, neighbor);
+	  if (countdown <= 0)
 	    {
-	      bear_shark (shark);
-	      breeding_countdown[neighbor] = shark_breeding_age;
+	      bear_shark (at (x, y));
+	      breeding_countdown[shark] = shark_breeding_age;
 	    }
 	}
     }
@@ -115,15 +135,27 @@ move_shark (int shark, int x, int y)
 static void
 tick (void)
 {
-  FOR_ALL_TURTLES (grid, fish_color, move_fish);
-  FOR_ALL_TURTLES (grid, shark_color, move_shark);
+  for_all_agents (&critters, fish_kind, move_fish);
+  for_all_agents (&critters, shark_kind, move_shark);
+}
+
+static void
+parallel_tick (void)
+{
+  for_all_agents_in_parallel (&critters, fish_kind, move_fish);
+  for_all_agents_in_parallel (&critters, shark_kind, move_shark);
 }
 
 void
 install_wator_words (ts_VM *vm)
 {
+  add_agent_field (&critters, &health, sizeof health[0]);
+  add_agent_field (&critters, &breeding_countdown, 
+		   sizeof breeding_countdown[0]);
+  on_new_grid (size_state);
   ts_install (vm, "wator-genesis",      ts_run_void_2, (tsint) genesis);
   ts_install (vm, "wator-tick",         ts_run_void_0, (tsint) tick);
+  ts_install (vm, "wator-parallel-tick", ts_run_void_0, (tsint) parallel_tick);
   ts_install (vm, "fish-breeding-age",  ts_do_push, (tsint) &fish_breeding_age);
   ts_install (vm, "shark-breeding-age", ts_do_push, (tsint) &shark_breeding_age);
   ts_install (vm, "shark-starve-time",  ts_do_push, (tsint) &shark_starve_time);
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+
+#include "tusdl.h"
+#include "workers.h"
+
+static int num_workers = 1;
+static SDL_Thread *threads[max_workers];
+
+/* Everything below is guarded by `lock'. */
+static SDL_mutex *lock = NULL;
+static SDL_cond *work_posted, *work_finished;
+
+static Job *current_job;
+static void *current_data;
+static int next_index, num_indices, num_done;
+static int posting = 0;		/* Bumped for each run_jobs() call */
+static int quitting = 0;
+
+/* Run pieces of the current job until there are none left to start. */
+static void
+work (int worker)
+{
+  for (;;)
+    {
+      Job *job;
+      void *data;
+      int i;
+
+      SDL_mutexP (lock);
+      if (num_indices <= next_index)
+	{
+	  SDL_mutexV (lock);
+	  return;
+	}
+      job = current_job;
+      data = current_data;
+      i = next_index++;
+      SDL_mutexV (lock);
+
+      job (data, i, worker);
+
+      SDL_mutexP (lock);
+      if (++num_done == num_indices)
+	SDL_CondBroadcast (work_finished);
+      SDL_mutexV (lock);
+    }
+}
+
+static int
+worker_main (void *arg)
+{
+  int worker = (int) (size_t) arg;
+  int seen = 0;
+  SDL_mutexP (lock);
+  for (;;)
+    {
+      while (posting == seen && !quitting)
+	SDL_CondWait (work_posted, lock);
+      if (quitting)
+	break;
+      seen = posting;
+      SDL_mutexV (lock);
+      work (worker);
+      SDL_mutexP (lock);
+    }
+  SDL_mutexV (lock);
+  return 0;
+}
+
+void
+set_workers (int n)
+{
+  int i;
+  if (n < 1)
+    n = 1;
+  if (max_workers < n)
+    n = max_workers;
+
+  if (lock == NULL)
+    {
+      lock          = SDL_CreateMutex ();
+      work_posted   = SDL_CreateCond ();
+      work_finished = SDL_CreateCond ();
+      if (lock == NULL || work_posted == NULL || work_finished == NULL)
+	die ("Couldn't create worker locks: %s", SDL_GetError ());
+    }
+
+  SDL_mutexP (lock);
+  quitting = 1;
+  SDL_CondBroadcast (work_posted);
+  SDL_mutexV (lock);
+  for (i = 1; i < num_workers; ++i)
+    SDL_WaitThread (threads[i], NULL);
+
+  quitting = 0;
+  num_workers = n;
+  for (i = 1; i < num_workers; ++i)
+    {
+      threads[i] = SDL_CreateThread (worker_main, (void *) (size_t) i);
+      if (threads[i] == NULL)
+	die ("Couldn't create a worker thread: %s", SDL_GetError ());
+    }
+}
+
+int
+worker_count (void)
+{
+  return num_workers;
+}
+
+void
+run_jobs (Job *job, void *data, int n)
+{
+  if (num_workers == 1)
+    {
+      int i;
+      for (i = 0; i < n; ++i)
+	job (data, i, 0);
+      return;
+    }
+
+  SDL_mutexP (lock);
+  current_job  = job;
+  current_data = data;
+  next_index   = 0;
+  num_indices  = n;
+  num_done     = 0;
+  ++posting;
+  SDL_CondBroadcast (work_posted);
+  SDL_mutexV (lock);
+
+  work (0);
+
+  SDL_mutexP (lock);
+  while (num_done < num_indices)
+    SDL_CondWait (work_finished, lock);
+  SDL_mutexV (lock);
+}
@@ -0,0 +1,22 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+/* A pool of threads to split computations across. */
+
+enum { max_workers = 64 };
+
+/* A job computes piece number `index' of whatever `data' describes.
+   `worker' is the number, from 0 to worker_count()-1, of the thread
+   running it, for picking out per-thread scratch space. */
+typedef void Job (void *data, int index, int worker);
+
+/* Use n threads in all, counting the caller's own. */
+void set_workers (int n);
+
+int worker_count (void);
+
+/* Run job on pieces 0..n-1 of data, spread across the workers, and
+   return when they're all done. */
+void run_jobs (Job *job, void *data, int n);
+
+#endif